@@ -0,0 +1,348 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "avrjs_bignum.h"
+
+#include <limits.h>
+#include <string.h>
+
+// limbs below the headroom limb, where parsed numbers and products must fit
+#define BIGNUM_VALUE_LIMBS (BIGNUM_LIMBS - 1)
+
+// skips the sign and any base prefix, 0 if str is not a number
+static const char* bignum_base(const char* str, uint8_t* const base)
+{
+	if ((*str == '-') || (*str == '+'))
+	{
+		++str;
+	}
+	*base = 10;
+	if (*str == '0')
+	{
+		if ((str[1] == 'x') || (str[1] == 'X'))
+		{
+			*base = 16;
+			str += 2;
+		}
+		else
+		{
+			*base = 8;
+		}
+	}
+	return (*str == 0) ? 0 : str;
+}
+
+// -1 if c is not a digit in base
+static int8_t bignum_digit_value(const char c, const uint8_t base)
+{
+	int8_t v = -1;
+	if ((c >= '0') && (c <= '9'))
+	{
+		v = c - '0';
+	}
+	else if ((c >= 'a') && (c <= 'f'))
+	{
+		v = c - 'a' + 10;
+	}
+	else if ((c >= 'A') && (c <= 'F'))
+	{
+		v = c - 'A' + 10;
+	}
+	return (v < base) ? v : -1;
+}
+
+// n = n * m + add over limbs, returns what is carried out of them
+static uint16_t bignum_mul_add(struct bignum* const n, const uint8_t limbs,
+	const uint16_t m, const uint16_t add)
+{
+	uint16_t carry = add;
+	for (uint8_t i = 0; i < limbs; ++i)
+	{
+		const uint32_t t = ((uint32_t)n->limb[i] * m) + carry;
+		n->limb[i] = (uint16_t)t;
+		carry = (uint16_t)(t >> 16);
+	}
+	return carry;
+}
+
+int bignum_parse(struct bignum* const n, const char* str)
+{
+	uint8_t base;
+	str = bignum_base(str, &base);
+	if (str == 0)
+	{
+		return -1;
+	}
+	bignum_zero(n);
+	for (; *str != 0; ++str)
+	{
+		const int8_t d = bignum_digit_value(*str, base);
+		if ((d < 0) || (bignum_mul_add(n, BIGNUM_VALUE_LIMBS, base, d) != 0))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+unsigned char bignum_is_number(const char* str)
+{
+	uint8_t base;
+	str = bignum_base(str, &base);
+	if (str == 0)
+	{
+		return 0;
+	}
+	for (; *str != 0; ++str)
+	{
+		if (bignum_digit_value(*str, base) < 0)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void bignum_copy(struct bignum* const dst, const struct bignum* const src)
+{
+	memcpy(dst, src, sizeof(*dst));
+}
+
+void bignum_set_u32(struct bignum* const n, const uint32_t v)
+{
+	bignum_zero(n);
+	n->limb[0] = (uint16_t)v;
+	n->limb[1] = (uint16_t)(v >> 16);
+}
+
+void bignum_zero(struct bignum* const n)
+{
+	memset(n, 0, sizeof(*n));
+}
+
+unsigned char bignum_is_zero(const struct bignum* const n)
+{
+	for (uint8_t i = 0; i < BIGNUM_LIMBS; ++i)
+	{
+		if (n->limb[i] != 0)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int bignum_cmp(const struct bignum* const a, const struct bignum* const b)
+{
+	uint8_t i = BIGNUM_LIMBS;
+	while (i != 0)
+	{
+		--i;
+		if (a->limb[i] != b->limb[i])
+		{
+			return (a->limb[i] > b->limb[i]) ? 1 : -1;
+		}
+	}
+	return 0;
+}
+
+void bignum_sub(struct bignum* const a, const struct bignum* const b)
+{
+	uint16_t borrow = 0;
+	for (uint8_t i = 0; i < BIGNUM_LIMBS; ++i)
+	{
+		const uint32_t t = (uint32_t)a->limb[i] - b->limb[i] - borrow;
+		a->limb[i] = (uint16_t)t;
+		borrow = (uint16_t)(t >> 31);
+	}
+}
+
+static uint16_t bignum_bit_length(const struct bignum* const n)
+{
+	uint8_t i = BIGNUM_LIMBS;
+	while (i != 0)
+	{
+		--i;
+		if (n->limb[i] != 0)
+		{
+			return (i * 16) + (sizeof(unsigned int) * CHAR_BIT) -
+				__builtin_clz(n->limb[i]);
+		}
+	}
+	return 0;
+}
+
+uint16_t bignum_trailing_zeros(const struct bignum* const n)
+{
+	uint8_t i = 0;
+	while (n->limb[i] == 0)
+	{
+		++i;
+	}
+	return (i * 16) + __builtin_ctz(n->limb[i]);
+}
+
+void bignum_shift_right(struct bignum* const n, const uint16_t bits)
+{
+	const uint8_t limbs = bits / 16;
+	const uint8_t shift = bits % 16;
+	for (uint8_t i = 0; i < BIGNUM_LIMBS; ++i)
+	{
+		const uint8_t j = i + limbs;
+		uint16_t v = 0;
+		if (j < BIGNUM_LIMBS)
+		{
+			v = n->limb[j] >> shift;
+			if ((shift != 0) && ((j + 1) < BIGNUM_LIMBS))
+			{
+				v |= (uint16_t)(n->limb[j + 1] << (16 - shift));
+			}
+		}
+		n->limb[i] = v;
+	}
+}
+
+int bignum_shift_left(struct bignum* const n, const uint16_t bits)
+{
+	if (bits == 0)
+	{
+		return 0;
+	}
+	const uint8_t limbs = bits / 16;
+	const uint8_t shift = bits % 16;
+	if ((bignum_bit_length(n) + bits) > (BIGNUM_VALUE_LIMBS * 16))
+	{
+		return -1;
+	}
+	for (uint8_t i = BIGNUM_LIMBS; i != 0;)
+	{
+		--i;
+		uint16_t v = 0;
+		if (i >= limbs)
+		{
+			v = (uint16_t)(n->limb[i - limbs] << shift);
+			if ((shift != 0) && (i > limbs))
+			{
+				v |= n->limb[i - limbs - 1] >> (16 - shift);
+			}
+		}
+		n->limb[i] = v;
+	}
+	return 0;
+}
+
+void bignum_div_exact_odd(struct bignum* const a, const struct bignum* const d)
+{
+	// the inverse of the low limb of d mod 2^16, d is right to 3 bits and
+	// each step of Newton's iteration doubles that
+	const uint16_t d0 = d->limb[0];
+	uint16_t inverse = d0;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const uint16_t e = 2 - (uint16_t)((uint32_t)d0 * inverse);
+		inverse = (uint16_t)((uint32_t)inverse * e);
+	}
+	// each quotient limb clears the lowest limb left of a, which then holds it
+	for (uint8_t i = 0; i < BIGNUM_LIMBS; ++i)
+	{
+		const uint16_t q = (uint16_t)((uint32_t)a->limb[i] * inverse);
+		uint16_t carry = 0;
+		uint16_t borrow = 0;
+		for (uint8_t j = i; j < BIGNUM_LIMBS; ++j)
+		{
+			const uint32_t product = ((uint32_t)q * d->limb[j - i]) + carry;
+			carry = (uint16_t)(product >> 16);
+			const uint32_t t = (uint32_t)a->limb[j] - (uint16_t)product -
+				borrow;
+			a->limb[j] = (uint16_t)t;
+			borrow = (uint16_t)(t >> 31);
+		}
+		a->limb[i] = q;
+	}
+}
+
+int bignum_mul(struct bignum* const a, const struct bignum* const b)
+{
+	if ((bignum_bit_length(a) + bignum_bit_length(b)) >
+		((BIGNUM_VALUE_LIMBS * 16) + 1))
+	{
+		return -1;
+	}
+	// from the top limb of a down, each is replaced by its row of the
+	// product, which only adds into the limbs above it
+	uint8_t i = BIGNUM_LIMBS;
+	while (i != 0)
+	{
+		--i;
+		const uint16_t m = a->limb[i];
+		a->limb[i] = 0;
+		uint16_t carry = 0;
+		for (uint8_t j = i; j < BIGNUM_LIMBS; ++j)
+		{
+			const uint32_t t = ((uint32_t)m * b->limb[j - i]) + a->limb[j] +
+				carry;
+			a->limb[j] = (uint16_t)t;
+			carry = (uint16_t)(t >> 16);
+		}
+	}
+	// widths that sum to one more than the limit may still fit
+	return (a->limb[BIGNUM_VALUE_LIMBS] != 0) ? -1 : 0;
+}
+
+uint8_t bignum_digits(const struct bignum* const n, struct bignum* const p)
+{
+	// the headroom limb takes the one power of 10 past n
+	bignum_zero(p);
+	p->limb[0] = 1;
+	uint8_t digits = 1;
+	while (1)
+	{
+		bignum_mul_add(p, BIGNUM_LIMBS, 10, 0);
+		if (bignum_cmp(p, n) > 0)
+		{
+			break;
+		}
+		++digits;
+	}
+	// back down to the leading digit
+	bignum_zero(p);
+	p->limb[0] = 1;
+	for (uint8_t i = 1; i < digits; ++i)
+	{
+		bignum_mul_add(p, BIGNUM_LIMBS, 10, 0);
+	}
+	return digits;
+}
+
+char bignum_digit(struct bignum* const n, const struct bignum* const p)
+{
+	// n stays below 10 p, so n is multiplied up rather than p divided down
+	char c = '0';
+	while (bignum_cmp(n, p) >= 0)
+	{
+		bignum_sub(n, p);
+		++c;
+	}
+	bignum_mul_add(n, BIGNUM_LIMBS, 10, 0);
+	return c;
+}
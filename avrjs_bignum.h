@@ -0,0 +1,74 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef AVRJS_BIGNUM_H
+#define AVRJS_BIGNUM_H
+
+#include "mcu_term.h"
+
+#include <stdint.h>
+
+// the widest argument is a hex one that fills the line buffer, "0x" and the
+// digits, gcd and lcm take them one at a time. The extra limb is headroom for
+// printing.
+#define BIGNUM_BITS ((MCU_TERM_BUFFER_SIZE - 3) * 4)
+#define BIGNUM_LIMBS (((BIGNUM_BITS + 15) / 16) + 1)
+
+// unsigned, least significant limb first
+struct bignum
+{
+	uint16_t limb[BIGNUM_LIMBS];
+};
+
+// the magnitude of a decimal, hex (0x) or octal (leading 0) number with an
+// optional sign, as strtol takes them. -1 if str is not a number or is wider
+// than BIGNUM_BITS.
+int bignum_parse(struct bignum* n, const char* str);
+// 1 if str has the form bignum_parse takes, however wide it is
+unsigned char bignum_is_number(const char* str);
+void bignum_copy(struct bignum* dst, const struct bignum* src);
+void bignum_set_u32(struct bignum* n, uint32_t v);
+void bignum_zero(struct bignum* n);
+unsigned char bignum_is_zero(const struct bignum* n);
+int bignum_cmp(const struct bignum* a, const struct bignum* b);
+// a -= b, a must not be less than b
+void bignum_sub(struct bignum* a, const struct bignum* b);
+// number of trailing zero bits, n must not be 0
+uint16_t bignum_trailing_zeros(const struct bignum* n);
+void bignum_shift_right(struct bignum* n, uint16_t bits);
+// -1 if a bit is shifted out of BIGNUM_BITS
+int bignum_shift_left(struct bignum* n, uint16_t bits);
+// a /= d where d is odd and divides a, by Hensel (2-adic) division, no
+// divisions are done
+void bignum_div_exact_odd(struct bignum* a, const struct bignum* d);
+// a *= b in place, -1 if the product is wider than BIGNUM_BITS rounded up to
+// whole limbs, 320 bits
+int bignum_mul(struct bignum* a, const struct bignum* b);
+// decimal digits, most significant first and one at a time so the text is
+// never held. bignum_digits sets p to the power of 10 of the leading digit and
+// returns the number of digits, bignum_digit then returns the next digit
+// character of n each call and consumes it.
+uint8_t bignum_digits(const struct bignum* n, struct bignum* p);
+char bignum_digit(struct bignum* n, const struct bignum* p);
+
+#endif
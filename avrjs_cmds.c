@@ -0,0 +1,603 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "avrjs_cmds.h"
+#include "avrjs_bignum.h"
+#include "avrjs_hw.h"
+#include "cyclebench.h"
+#include "mcu_task.h"
+#include "mcu_term.h"
+
+#include <limits.h>
+
+// the AVR has no divider, a 32 bit % is a few hundred cycles in libgcc, so
+// gcd and lcm are done with shifts and subtractions, and the one multiply
+// the lcm itself needs
+
+static uint32_t magnitude(const int32_t a)
+{
+	return (a < 0) ? -(uint32_t)a : (uint32_t)a;
+}
+
+static uint8_t trailing_zeros(const uint32_t a)
+{
+	return __builtin_ctzl(a);
+}
+
+static uint8_t bit_length(const uint32_t a)
+{
+	return (a == 0) ? 0 : (sizeof(unsigned long) * CHAR_BIT) -
+		__builtin_clzl(a);
+}
+
+// up to n rounds of the binary gcd loop, x must be odd. Done when y is 0 and
+// x holds the odd part of the gcd.
+static void gcd_steps(uint32_t* const x, uint32_t* const y, uint8_t n)
+{
+	uint32_t u = *x;
+	uint32_t v = *y;
+	while ((v != 0) && (n != 0))
+	{
+		v >>= trailing_zeros(v);
+		const uint32_t low = (u < v) ? u : v;
+		v = (u < v) ? (v - u) : (u - v);
+		u = low;
+		--n;
+	}
+	*x = u;
+	*y = v;
+}
+
+// a / d where d is known to divide a, a quotient bit at a time from the
+// bottom. With d odd the low bit of what is left of a is the next quotient
+// bit, taking d away when it is set leaves a multiple of 2d. No multiplies,
+// the ATtiny has no multiplier either.
+static uint32_t exact_div(uint32_t a, uint32_t d)
+{
+	const uint8_t shift = trailing_zeros(d);
+	a >>= shift;
+	d >>= shift;
+	uint32_t q = 0;
+	uint32_t bit = 1;
+	while (a != 0)
+	{
+		if ((a & 1) != 0)
+		{
+			a -= d;
+			q |= bit;
+		}
+		a >>= 1;
+		bit <<= 1;
+	}
+	return q;
+}
+
+// x * y / g for magnitudes, g their gcd. A product of bit lengths m and n has
+// m + n - 1 or m + n bits, so a sum of up to 32 fits in the multiply.
+static int lcm_finish(const uint32_t x, const uint32_t y, const uint32_t g,
+	uint32_t* const result)
+{
+	if (g == 0)
+	{
+		*result = 0;
+		return 0;
+	}
+	const uint32_t q = exact_div(x, g);
+	if ((bit_length(q) + bit_length(y)) > 32)
+	{
+		return -1;
+	}
+	const uint32_t p = q * y;
+	if (p > INT32_MAX)
+	{
+		return -1;
+	}
+	*result = p;
+	return 0;
+}
+
+uint32_t gcd(const int32_t a, const int32_t b)
+{
+	uint32_t x = magnitude(a);
+	uint32_t y = magnitude(b);
+	if ((x == 0) || (y == 0))
+	{
+		return x | y;
+	}
+	const uint8_t shift = trailing_zeros(x | y);
+	x >>= trailing_zeros(x);
+	while (y != 0)
+	{
+		gcd_steps(&x, &y, UINT8_MAX);
+	}
+	return x << shift;
+}
+
+int lcm(const int32_t a, const int32_t b, uint32_t* const result)
+{
+	const uint32_t x = magnitude(a);
+	const uint32_t y = magnitude(b);
+	if ((x == 0) || (y == 0))
+	{
+		*result = 0;
+		return 0;
+	}
+	return lcm_finish(x, y, gcd(a, b), result);
+}
+
+#if defined(CYCLEBENCH) || !defined(__AVR__)
+uint32_t euclid_gcd(const int32_t a, const int32_t b)
+{
+	uint32_t x = magnitude(a);
+	uint32_t y = magnitude(b);
+	while (y != 0)
+	{
+		const uint32_t r = x % y;
+		x = y;
+		y = r;
+	}
+	return x;
+}
+
+int euclid_lcm(const int32_t a, const int32_t b, uint32_t* const result)
+{
+	const int32_t g = (int32_t)euclid_gcd(a, b);
+	if ((g == 0) || (b == 0))
+	{
+		*result = 0;
+		return 0;
+	}
+	const int32_t tmp = a / g;
+	const int32_t product = (int32_t)((uint32_t)tmp * (uint32_t)b);
+	if (tmp != (product / b))
+	{
+		return -1;
+	}
+	*result = magnitude(product);
+	return ((*result) > INT32_MAX) ? -1 : 0;
+}
+#endif
+
+#if defined(CYCLEBENCH)
+// runs the binary and the Euclid kernel to the end on the operands of a
+// stream step, each under its own probe, so the report compares them on the
+// device. The harness does not charge their cycles to gcd_token_cb.
+static void gcd_kernels(const uint32_t x, const uint32_t y,
+	const unsigned char lcm_kernels)
+{
+	volatile uint32_t sink;
+	uint32_t r = 0;
+	if (lcm_kernels == 0)
+	{
+		CYCLEBENCH_ENTER(CYCLEBENCH_binary_gcd);
+		sink = gcd((int32_t)x, (int32_t)y);
+		CYCLEBENCH_EXIT(CYCLEBENCH_binary_gcd);
+		CYCLEBENCH_ENTER(CYCLEBENCH_euclid_gcd);
+		sink = euclid_gcd((int32_t)x, (int32_t)y);
+		CYCLEBENCH_EXIT(CYCLEBENCH_euclid_gcd);
+	}
+	else
+	{
+		CYCLEBENCH_ENTER(CYCLEBENCH_binary_lcm);
+		lcm((int32_t)x, (int32_t)y, &r);
+		CYCLEBENCH_EXIT(CYCLEBENCH_binary_lcm);
+		sink = r;
+		CYCLEBENCH_ENTER(CYCLEBENCH_euclid_lcm);
+		euclid_lcm((int32_t)x, (int32_t)y, &r);
+		CYCLEBENCH_EXIT(CYCLEBENCH_euclid_lcm);
+		sink = r;
+	}
+	(void)sink;
+}
+#endif
+
+// gcd and lcm take their arguments as they are typed (see struct
+// mcu_term_stream), so a list of numbers may be longer than a line. Each
+// argument is folded into the result as it arrives by a task, a few rounds of
+// the binary gcd per slice so input and output are serviced in between. One
+// stream per port's terminal is enough, a command that finds none free is
+// refused.
+#define GCD_STREAMS UART_PORTS
+#define GCD_SLICE 8
+
+enum gcd_error
+{
+	GCD_OK,
+	GCD_NOT_A_NUMBER,
+	GCD_TOO_LARGE,
+	GCD_BUSY
+};
+
+struct gcd_stream
+{
+	struct mcu_task task;
+	unsigned char in_use;
+	unsigned char lcm;
+	unsigned char wide; // the result is in gcd_wide
+	uint8_t error; // enum gcd_error, the rest of the line is ignored
+	uint8_t shift;
+	size_t count; // arguments so far
+	size_t bad; // the argument that was not a number
+	const char* token; // the argument being folded in
+	uint32_t acc;
+	uint32_t arg;
+	uint32_t x;
+	uint32_t y;
+};
+
+static struct gcd_stream gcd_streams[GCD_STREAMS];
+
+// a result that outgrows 32 bits, or an argument that does, is worked on as a
+// bignum from there on. There is one of these and the three numbers are
+// large, a stream that needs it while another has it is refused.
+#define BIGNUM_SLICE 2
+
+struct gcd_wide
+{
+	struct gcd_stream* owner;
+	uint16_t shift;
+	uint8_t digits;
+	struct bignum* acc;
+	struct bignum* u;
+	struct bignum* v;
+	struct bignum n[3];
+};
+
+static struct gcd_wide gcd_wide;
+
+// the one of the three numbers that is neither a nor b
+static struct bignum* bignum_other(const struct bignum* const a,
+	const struct bignum* const b)
+{
+	struct bignum* n = gcd_wide.n;
+	while ((n == a) || (n == b))
+	{
+		++n;
+	}
+	return n;
+}
+
+// up to n rounds of the binary gcd loop on bignums, as gcd_steps
+static void bignum_gcd_steps(struct gcd_wide* const w, uint8_t n)
+{
+	while ((!bignum_is_zero(w->v)) && (n != 0))
+	{
+		bignum_shift_right(w->v, bignum_trailing_zeros(w->v));
+		if (bignum_cmp(w->u, w->v) > 0)
+		{
+			struct bignum* const swap = w->u;
+			w->u = w->v;
+			w->v = swap;
+		}
+		bignum_sub(w->v, w->u);
+		--n;
+	}
+}
+
+// moves the 32 bit result to a bignum, -1 with the stream refused if another
+// stream has the bignums
+static int gcd_widen(struct gcd_stream* const s)
+{
+	struct gcd_wide* const w = &gcd_wide;
+	if (w->owner != 0)
+	{
+		s->error = GCD_BUSY;
+		return -1;
+	}
+	w->owner = s;
+	w->acc = w->n;
+	bignum_set_u32(w->acc, s->acc);
+	s->wide = 1;
+	return 0;
+}
+
+static void gcd_release(struct gcd_stream* const s)
+{
+	if (s->wide != 0)
+	{
+		gcd_wide.owner = 0;
+	}
+	s->in_use = 0;
+}
+
+// folds s->y, also in s->arg, into the 32 bit result in s->x and s->acc, or
+// w->v, parsed from s->token, into the bignum result. Neither is 0.
+static int gcd_fold_step(struct gcd_stream* const s)
+{
+	struct gcd_wide* const w = &gcd_wide;
+	MCU_TASK_BEGIN(&s->task);
+	if (s->wide == 0)
+	{
+		s->shift = trailing_zeros(s->x | s->y);
+		s->x >>= trailing_zeros(s->x);
+		while (s->y != 0)
+		{
+			gcd_steps(&s->x, &s->y, GCD_SLICE);
+			MCU_TASK_YIELD(&s->task);
+		}
+		s->x <<= s->shift;
+		if (s->lcm == 0)
+		{
+			s->acc = s->x;
+		}
+		else if (lcm_finish(s->acc, s->arg, s->x, &s->acc) != 0)
+		{ // acc / gcd * arg is under 64 bits, it fits a bignum
+			s->acc = exact_div(s->acc, s->x);
+			if (gcd_widen(s) == 0)
+			{
+				w->v = bignum_other(w->acc, 0);
+				bignum_set_u32(w->v, s->arg);
+				bignum_mul(w->acc, w->v);
+			}
+		}
+		MCU_TASK_EXIT(&s->task);
+	}
+	if (s->lcm == 0)
+	{
+		w->u = w->acc;
+	}
+	else
+	{ // the accumulated lcm is kept to be divided by the gcd
+		w->u = bignum_other(w->acc, w->v);
+		bignum_copy(w->u, w->acc);
+	}
+	w->shift = bignum_trailing_zeros(w->u);
+	{
+		const uint16_t v_shift = bignum_trailing_zeros(w->v);
+		bignum_shift_right(w->u, w->shift);
+		if (v_shift < w->shift)
+		{
+			w->shift = v_shift;
+		}
+	}
+	while (!bignum_is_zero(w->v))
+	{
+		bignum_gcd_steps(w, BIGNUM_SLICE);
+		MCU_TASK_YIELD(&s->task);
+	}
+	// u holds the odd part of the gcd
+	if (s->lcm == 0)
+	{
+		bignum_shift_left(w->u, w->shift);
+		w->acc = w->u;
+	}
+	else
+	{
+		bignum_shift_right(w->acc, w->shift);
+		bignum_div_exact_odd(w->acc, w->u);
+		// the argument was used up by the gcd, it is cheaper to parse it
+		// again than to keep a copy, the terminal keeps it until the task is
+		// done
+		bignum_parse(w->v, s->token);
+		if (bignum_mul(w->acc, w->v) != 0)
+		{
+			s->error = GCD_TOO_LARGE;
+		}
+	}
+	MCU_TASK_END(&s->task);
+}
+
+static int gcd_fold_run(void* arg)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_gcd_fold);
+	const int r = gcd_fold_step(arg);
+	CYCLEBENCH_EXIT(CYCLEBENCH_gcd_fold);
+	return r;
+}
+
+// the bignum result a digit per slice, then the stream is done with
+static int gcd_print_step(struct gcd_stream* const s)
+{
+	struct gcd_wide* const w = &gcd_wide;
+	MCU_TASK_BEGIN(&s->task);
+	w->u = bignum_other(w->acc, 0);
+	w->digits = bignum_digits(w->acc, w->u);
+	while (w->digits != 0)
+	{
+		mcu_term_out_char(bignum_digit(w->acc, w->u));
+		--w->digits;
+		MCU_TASK_YIELD(&s->task);
+	}
+	mcu_term_out_P(PSTR("\r\n"));
+	gcd_release(s);
+	MCU_TASK_END(&s->task);
+}
+
+static int gcd_print_run(void* arg)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_gcd_print);
+	const int r = gcd_print_step(arg);
+	CYCLEBENCH_EXIT(CYCLEBENCH_gcd_print);
+	return r;
+}
+
+// runs task as the terminal's task, or to the end when there is no terminal
+// to defer to, e.g. in binary mode
+static void gcd_spawn(struct gcd_stream* const s, int (* const task)(void*))
+{
+	MCU_TASK_INIT(&s->task);
+	if (mcu_term_spawn(task, s) != 0)
+	{
+		while (task(s) != MCU_TASK_DONE)
+		{
+		}
+	}
+}
+
+static void* gcd_begin(const unsigned char lcm)
+{
+	for (size_t i = 0; i < GCD_STREAMS; ++i)
+	{
+		struct gcd_stream* const s = gcd_streams + i;
+		if (s->in_use == 0)
+		{
+			s->in_use = 1;
+			s->lcm = lcm;
+			s->wide = 0;
+			s->error = GCD_OK;
+			s->count = 0;
+			return s;
+		}
+	}
+	return 0;
+}
+
+void* gcd_begin_cb(void* arg)
+{
+	(void) arg;
+	return gcd_begin(0);
+}
+
+void* lcm_begin_cb(void* arg)
+{
+	(void) arg;
+	return gcd_begin(1);
+}
+
+static void gcd_token(struct gcd_stream* const s, const char* const token)
+{
+	++s->count;
+	if (s->error != GCD_OK)
+	{
+		return;
+	}
+	int32_t value;
+	if ((s->wide == 0) && (mcu_term_parse_int(token, 0, &value) == 0))
+	{
+		const uint32_t a = magnitude(value);
+		if (s->count == 1)
+		{
+			s->acc = a;
+			return;
+		}
+		if ((s->acc == 0) || (a == 0))
+		{ // gcd(x, 0) is x, lcm(x, 0) is 0
+			s->acc = (s->lcm != 0) ? 0 : (s->acc | a);
+			return;
+		}
+#if defined(CYCLEBENCH)
+		gcd_kernels(s->acc, a, s->lcm);
+#endif
+		s->x = s->acc;
+		s->y = a;
+		s->arg = a;
+		gcd_spawn(s, &gcd_fold_run);
+		return;
+	}
+	// wider than 32 bits, or the result already is. Text that is no number
+	// at all is refused without taking the bignums from another stream.
+	if (bignum_is_number(token) == 0)
+	{
+		s->error = GCD_NOT_A_NUMBER;
+		s->bad = s->count;
+		return;
+	}
+	if ((s->wide == 0) && (gcd_widen(s) != 0))
+	{
+		return;
+	}
+	struct gcd_wide* const w = &gcd_wide;
+	w->v = bignum_other(w->acc, 0);
+	if (bignum_parse(w->v, token) != 0)
+	{
+		s->error = GCD_NOT_A_NUMBER;
+		s->bad = s->count;
+		return;
+	}
+	if (s->count == 1)
+	{
+		w->acc = w->v;
+		return;
+	}
+	if (bignum_is_zero(w->acc) || bignum_is_zero(w->v))
+	{
+		if (s->lcm != 0)
+		{
+			bignum_zero(w->acc);
+		}
+		else if (bignum_is_zero(w->acc))
+		{
+			w->acc = w->v;
+		}
+		return;
+	}
+	s->token = token;
+	gcd_spawn(s, &gcd_fold_run);
+}
+
+void gcd_token_cb(void* state, const char* token)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_gcd_token_cb);
+	gcd_token(state, token);
+	CYCLEBENCH_EXIT(CYCLEBENCH_gcd_token_cb);
+}
+
+static void gcd_end(struct gcd_stream* const s, const size_t count,
+	const unsigned char complete)
+{
+	if (s == 0)
+	{
+		mcu_term_out_P(PSTR("busy, try again\r\n"));
+		return;
+	}
+	if (complete == 0)
+	{ // the terminal has said why
+		gcd_release(s);
+		return;
+	}
+	if (count < 2)
+	{
+		mcu_term_printf_P(PSTR("Invalid number of args, %s requires at least "
+			"2\r\n"), (s->lcm != 0) ? "lcm" : "gcd");
+	}
+	else if (s->error == GCD_NOT_A_NUMBER)
+	{
+		mcu_term_printf_P(PSTR("argument %u is not a number or too large\r\n"),
+			(unsigned int)s->bad);
+	}
+	else if (s->error == GCD_TOO_LARGE)
+	{
+		mcu_term_out_P(PSTR("result too large\r\n"));
+	}
+	else if (s->error == GCD_BUSY)
+	{
+		mcu_term_out_P(PSTR("busy, try again\r\n"));
+	}
+	else if (s->wide != 0)
+	{
+		gcd_spawn(s, &gcd_print_run);
+		return;
+	}
+	else
+	{
+		mcu_term_printf_P(PSTR("%lu\r\n"), (unsigned long int)s->acc);
+	}
+	gcd_release(s);
+}
+
+void gcd_end_cb(void* state, size_t count, unsigned char complete)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_gcd_end_cb);
+	gcd_end(state, count, complete);
+	CYCLEBENCH_EXIT(CYCLEBENCH_gcd_end_cb);
+}
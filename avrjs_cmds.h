@@ -0,0 +1,49 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef AVRJS_CMDS_H
+#define AVRJS_CMDS_H
+
+#include "mcu_term.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// binary (Stein's) gcd of the magnitudes, so gcd(INT32_MIN, 0) is 2^31
+uint32_t gcd(int32_t a, int32_t b);
+// lcm of the magnitudes, -1 if it does not fit into an int32_t
+int lcm(int32_t a, int32_t b, uint32_t* result);
+#if defined(CYCLEBENCH) || !defined(__AVR__)
+// the Euclid gcd and division checked lcm the binary kernels replaced, kept
+// so the benchmarks can run both on the same operands
+uint32_t euclid_gcd(int32_t a, int32_t b);
+int euclid_lcm(int32_t a, int32_t b, uint32_t* result);
+#endif
+// both commands stream two or more integers of any width, a table entry
+// points their struct mcu_term_stream at begin, gcd_token_cb and gcd_end_cb
+void* gcd_begin_cb(void* arg);
+void* lcm_begin_cb(void* arg);
+void gcd_token_cb(void* state, const char* token);
+void gcd_end_cb(void* state, size_t count, unsigned char complete);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,293 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// hardware layer under the UART driver and the main loop. On AVR everything
+// here is a thin inline wrapper around the registers, on the host it is
+// implemented by avrjs_hw_host.c on top of stdin/stdout or a pseudo-terminal.
+// The uart_hw_* functions take the index of the USART, a constant once the
+// per-port ISRs in avrjs_uart.c are inlined.
+
+#ifndef AVRJS_HW_H
+#define AVRJS_HW_H
+
+#include <stdint.h>
+
+// for what the ISRs call, the firmware is built with -O0 which otherwise
+// inlines nothing
+#define HW_ALWAYS_INLINE inline __attribute__((always_inline))
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#if defined(__AVR_ATmega328__)
+#define UART0_RX_vect USART_RX_vect
+#define UART0_UDRE_vect USART_UDRE_vect
+#else
+#define UART0_RX_vect USART0_RX_vect
+#define UART0_UDRE_vect USART0_UDRE_vect
+#endif
+
+// the second USART's rings and terminal take about 400 bytes, more than a
+// part with 1 KB of SRAM can spare, so those only drive USART0 unless the
+// build defines UART_PORTS=2
+#if defined(UDR1)
+#define UART1_RX_vect USART1_RX_vect
+#define UART1_UDRE_vect USART1_UDRE_vect
+#if !defined(UART_PORTS)
+#if defined(RAMSTART) && ((RAMEND - RAMSTART + 1) <= 1024)
+#define UART_PORTS 1
+#else
+#define UART_PORTS 2
+#endif
+#endif
+#else
+#undef UART_PORTS
+#define UART_PORTS 1
+#endif
+
+static inline void hw_irq_disable(void)
+{
+	cli();
+}
+
+static inline void hw_irq_enable(void)
+{
+	sei();
+}
+
+static inline unsigned char hw_irq_enabled(void)
+{
+	return ((SREG & (1 << SREG_I)) != 0) ? 1 : 0;
+}
+
+static inline void hw_sleep_init(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+// must be called with interrupts disabled, returns with them enabled after the
+// next interrupt has been serviced
+static inline void hw_sleep(void)
+{
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+static inline void uart_hw_baud(const uint8_t port, const uint16_t ubrr,
+	const uint8_t u2x)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UBRR1H = (uint8_t)(ubrr >> 8);
+		UBRR1L = (uint8_t)ubrr;
+		UCSR1A = (u2x != 0) ? (1 << U2X1) : 0;
+		return;
+	}
+#endif
+	(void)port;
+	UBRR0H = (uint8_t)(ubrr >> 8);
+	UBRR0L = (uint8_t)ubrr;
+	UCSR0A = (u2x != 0) ? (1 << U2X0) : 0;
+}
+
+static inline void uart_hw_init(const uint8_t port, const uint16_t brr)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UBRR1H = (uint8_t)(brr >> 8); // setup baud rate register
+		UBRR1L = (uint8_t)brr;
+
+		UCSR1B = (1 << RXEN1) | (1 << TXEN1) | (1 << RXCIE1); // enable rx and tx, enable rx interrupt
+		UCSR1C = (1 << USBS1) | (3 << UCSZ10); // 8N1
+		return;
+	}
+#endif
+	(void)port;
+	UBRR0H = (uint8_t)(brr >> 8); // setup baud rate register
+	UBRR0L = (uint8_t)brr;
+
+	UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0); // enable rx and tx, enable rx interrupt
+	UCSR0C = (1 << USBS0) | (3 << UCSZ00); // 8N1
+}
+
+// the last byte written has left the shift register
+static inline unsigned char uart_hw_tx_complete(const uint8_t port)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		return ((UCSR1A & (1 << TXC1)) != 0) ? 1 : 0;
+	}
+#endif
+	(void)port;
+	return ((UCSR0A & (1 << TXC0)) != 0) ? 1 : 0;
+}
+
+static inline void uart_hw_destroy(const uint8_t port)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UBRR1H = 0x00;
+		UBRR1L = 0x00;
+
+		UCSR1A = 0x20;
+		UCSR1B = 0x00;
+		UCSR1C = 0x06;
+		return;
+	}
+#endif
+	(void)port;
+	UBRR0H = 0x00;
+	UBRR0L = 0x00;
+
+	UCSR0A = 0x20;
+	UCSR0B = 0x00;
+	UCSR0C = 0x06;
+}
+
+static HW_ALWAYS_INLINE void uart_hw_udrie_enable(const uint8_t port)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UCSR1B |= (1 << UDRIE1);
+		return;
+	}
+#endif
+	(void)port;
+	UCSR0B |= (1 << UDRIE0); // enable UDR empty interrupt
+}
+
+static HW_ALWAYS_INLINE void uart_hw_udrie_disable(const uint8_t port)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UCSR1B &= ~(1 << UDRIE1);
+		return;
+	}
+#endif
+	(void)port;
+	UCSR0B &= ~(1 << UDRIE0); // disable UDR empty interrupt
+}
+
+static HW_ALWAYS_INLINE uint8_t uart_hw_read(const uint8_t port)
+{
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		return UDR1;
+	}
+#endif
+	(void)port;
+	return UDR0;
+}
+
+static HW_ALWAYS_INLINE void uart_hw_write(const uint8_t port,
+	const uint8_t b)
+{
+	// TXC is cleared by writing it as one, keep U2X
+#if UART_PORTS > 1
+	if (port != 0)
+	{
+		UCSR1A = (UCSR1A & (1 << U2X1)) | (1 << TXC1);
+		UDR1 = b;
+		return;
+	}
+#endif
+	(void)port;
+	UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
+	UDR0 = b;
+}
+
+#else
+
+#include <string.h>
+
+// UART1 only carries data when AVRJS_PTY1 is set, see avrjs_hw_host.c
+#define UART_PORTS 2
+
+// the host has a single address space, flash strings are ordinary constants
+#define PROGMEM
+#define PSTR(s) (s)
+#define printf_P printf
+#define fputs_P fputs
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+// there are no interrupts on the host, ISRs run synchronously from
+// hw_sleep and uart_hw_udrie_enable so atomic blocks need no protection
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (int atomic_once_ = 1; atomic_once_ != 0; \
+	atomic_once_ = 0)
+
+static inline void hw_irq_disable(void)
+{
+}
+
+static inline void hw_irq_enable(void)
+{
+}
+
+static inline unsigned char hw_irq_enabled(void)
+{
+	return 1;
+}
+
+static inline void hw_sleep_init(void)
+{
+}
+
+void hw_sleep(void);
+
+void uart_hw_init(uint8_t port, uint16_t brr);
+void uart_hw_baud(uint8_t port, uint16_t ubrr, uint8_t u2x);
+unsigned char uart_hw_tx_complete(uint8_t port);
+void uart_hw_destroy(uint8_t port);
+void uart_hw_udrie_enable(uint8_t port);
+void uart_hw_udrie_disable(uint8_t port);
+uint8_t uart_hw_read(uint8_t port);
+void uart_hw_write(uint8_t port, uint8_t b);
+
+// ISR bodies, defined in avrjs_uart.c, called when a byte arrives or can be
+// sent. On AVR the bodies are inlined into the vectors instead.
+void uart0_rx_isr(void);
+void uart0_udre_isr(void);
+#if UART_PORTS > 1
+void uart1_rx_isr(void);
+void uart1_udre_isr(void);
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// host stand-in for the USART hardware. UART0 bytes are read from stdin and
+// written to stdout, or, if AVRJS_PTY is set in the environment, from/to a
+// freshly allocated pseudo-terminal whose name is printed on stderr. UART1 is
+// only connected, to a pseudo-terminal of its own, if AVRJS_PTY1 is set.
+
+#include "avrjs_hw.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define HW_TX_BUFFER_WIDTH 256
+
+struct hw_port
+{
+	int in_fd; // -1 if nothing is connected
+	int out_fd;
+	int tty;
+	uint8_t rx_byte;
+	unsigned char udrie;
+	unsigned char draining;
+	uint8_t tx_buffer[HW_TX_BUFFER_WIDTH];
+	size_t tx_population;
+};
+
+static struct hw_port hw_ports[UART_PORTS] = {
+	{ .in_fd = -1, .out_fd = -1 },
+	{ .in_fd = -1, .out_fd = -1 }
+};
+static void (*const hw_rx_isrs[UART_PORTS])(void) = {
+	&uart0_rx_isr,
+	&uart1_rx_isr
+};
+static void (*const hw_udre_isrs[UART_PORTS])(void) = {
+	&uart0_udre_isr,
+	&uart1_udre_isr
+};
+static int hw_raw = 0;
+static int hw_exit_registered = 0;
+static struct termios hw_saved_termios;
+
+static void hw_tx_flush(struct hw_port *const p)
+{
+	size_t done = 0;
+	while ((p->out_fd >= 0) && (done < p->tx_population))
+	{
+		ssize_t n = write(p->out_fd, p->tx_buffer + done,
+			p->tx_population - done);
+		if (n <= 0)
+		{
+			break;
+		}
+		done += n;
+	}
+	p->tx_population = 0;
+}
+
+static void hw_restore_termios(void)
+{
+	for (size_t i = 0; i < UART_PORTS; ++i)
+	{
+		hw_tx_flush(hw_ports + i);
+	}
+	if (hw_raw != 0)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &hw_saved_termios);
+	}
+}
+
+static void hw_make_raw(const int fd)
+{
+	struct termios t;
+	if (tcgetattr(fd, &t) != 0)
+	{
+		return;
+	}
+	if (fd == STDIN_FILENO)
+	{
+		hw_saved_termios = t;
+		hw_raw = 1;
+	}
+	cfmakeraw(&t);
+	tcsetattr(fd, TCSANOW, &t);
+}
+
+static int hw_open_pty(const uint8_t port)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0))
+	{
+		return -1;
+	}
+	hw_make_raw(fd);
+	fprintf(stderr, "avrjs_term: UART%u on %s\n", port, ptsname(fd));
+	return fd;
+}
+
+void hw_sleep(void)
+{
+	for (size_t i = 0; i < UART_PORTS; ++i)
+	{
+		hw_tx_flush(hw_ports + i);
+	}
+	struct pollfd fds[UART_PORTS];
+	for (size_t i = 0; i < UART_PORTS; ++i)
+	{
+		fds[i].fd = hw_ports[i].in_fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	if (poll(fds, UART_PORTS, -1) <= 0)
+	{
+		exit(0);
+	}
+	for (uint8_t i = 0; i < UART_PORTS; ++i)
+	{
+		if (fds[i].revents == 0)
+		{
+			continue;
+		}
+		struct hw_port *const p = hw_ports + i;
+		uint8_t b;
+		ssize_t n = read(p->in_fd, &b, 1);
+		if (i != 0)
+		{ // UART1 going away leaves UART0 running
+			if (n <= 0)
+			{
+				p->in_fd = -1;
+				continue;
+			}
+		}
+		else if ((n <= 0) ||
+			((hw_raw != 0) && ((b == 0x03) || (b == 0x04))))
+		{ // end of input, or ^C/^D on the raw controlling terminal, a pty
+			// may carry binary frames
+			exit(0);
+		}
+		if ((p->tty == 0) && (b == '\n'))
+		{ // let plain text scripts be piped in
+			b = '\r';
+		}
+		p->rx_byte = b;
+		hw_rx_isrs[i]();
+		// one byte per sleep, as with a real interrupt
+		break;
+	}
+}
+
+void uart_hw_init(const uint8_t port, const uint16_t brr)
+{
+	(void)brr;
+	struct hw_port *const p = hw_ports + port;
+	if (port == 0)
+	{
+		p->in_fd = STDIN_FILENO;
+		p->out_fd = STDOUT_FILENO;
+		if (getenv("AVRJS_PTY") != NULL)
+		{
+			int fd = hw_open_pty(port);
+			if (fd >= 0)
+			{
+				p->in_fd = fd;
+				p->out_fd = fd;
+			}
+		}
+		else if (isatty(STDIN_FILENO))
+		{
+			hw_make_raw(STDIN_FILENO);
+		}
+	}
+	else if (getenv("AVRJS_PTY1") != NULL)
+	{
+		int fd = hw_open_pty(port);
+		p->in_fd = fd;
+		p->out_fd = fd;
+	}
+	p->tty = (p->in_fd >= 0) ? isatty(p->in_fd) : 0;
+	if (hw_exit_registered == 0)
+	{
+		atexit(&hw_restore_termios);
+		hw_exit_registered = 1;
+	}
+}
+
+void uart_hw_baud(const uint8_t port, const uint16_t ubrr, const uint8_t u2x)
+{ // a pipe or pty has no line rate
+	(void)port;
+	(void)ubrr;
+	(void)u2x;
+}
+
+unsigned char uart_hw_tx_complete(const uint8_t port)
+{
+	hw_tx_flush(hw_ports + port);
+	return 1;
+}
+
+void uart_hw_destroy(const uint8_t port)
+{
+	hw_tx_flush(hw_ports + port);
+}
+
+void uart_hw_udrie_enable(const uint8_t port)
+{
+	struct hw_port *const p = hw_ports + port;
+	p->udrie = 1;
+	if (p->draining == 0)
+	{ // the line is infinitely fast, empty the tx buffer now
+		p->draining = 1;
+		while (p->udrie != 0)
+		{
+			hw_udre_isrs[port]();
+		}
+		p->draining = 0;
+	}
+}
+
+void uart_hw_udrie_disable(const uint8_t port)
+{
+	hw_ports[port].udrie = 0;
+}
+
+uint8_t uart_hw_read(const uint8_t port)
+{
+	return hw_ports[port].rx_byte;
+}
+
+void uart_hw_write(const uint8_t port, const uint8_t b)
+{
+	struct hw_port *const p = hw_ports + port;
+	if (p->tx_population == HW_TX_BUFFER_WIDTH)
+	{
+		hw_tx_flush(p);
+	}
+	p->tx_buffer[p->tx_population] = b;
+	++p->tx_population;
+}
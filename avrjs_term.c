@@ -21,155 +21,388 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include "avrjs_cmds.h"
+#include "avrjs_hw.h"
 #include "avrjs_uart.h"
+#include "cyclebench.h"
+#include "mcu_bin.h"
 #include "mcu_term.h"
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/sleep.h>
+static void baud_cmd_cb(void* arg, size_t argc, char** argv,
+	const int32_t* vals);
+static void bin_cmd_cb(void* arg, size_t argc, char** argv);
 
-#include <stdio.h>
-#include <limits.h>
+static const char baud_str[] MCU_TERM_PROGMEM = "baud";
+static const char bin_str[] MCU_TERM_PROGMEM = "bin";
+static const char gcd_str[] MCU_TERM_PROGMEM = "gcd";
+static const char lcm_str[] MCU_TERM_PROGMEM = "lcm";
+
+static const struct mcu_term_schema baud_schema MCU_TERM_PROGMEM = {
+	1, 1, 0, 1, INT32_MAX
+};
+
+static const struct mcu_term_stream gcd_stream MCU_TERM_PROGMEM = {
+	&gcd_begin_cb, &gcd_token_cb, &gcd_end_cb
+};
+static const struct mcu_term_stream lcm_stream MCU_TERM_PROGMEM = {
+	&lcm_begin_cb, &gcd_token_cb, &gcd_end_cb
+};
+
+// sorted by name, the index of a command is also its binary mode id
+static const struct mcu_term_const_cmd term_cmds[] MCU_TERM_PROGMEM = {
+	{ baud_str, 0, 0, &baud_schema, &baud_cmd_cb, 0 },
+	{ bin_str, &bin_cmd_cb, 0, 0, 0, 0 },
+	{ gcd_str, 0, 0, 0, 0, &gcd_stream },
+	{ lcm_str, 0, 0, 0, 0, &lcm_stream }
+};
+
+// terminals serviced from the main loop, one per port driven unless
+// overridden, which is one on parts with 1 KB of SRAM (see avrjs_hw.h)
+#if !defined(TERM_PORTS)
+#define TERM_PORTS UART_PORTS
+#endif
+
+// input is taken from the port a line at a time in line mode
+#if defined(AVRJS_RX_LINE_MODE)
+#define TERM_RX_SIZE UART_RX_BUFFER_WIDTH
+#else
+#define TERM_RX_SIZE 1
+#endif
+
+struct term
+{
+	struct uart_port* uart;
+	struct mcu_term mt;
+	// set by the bin command, binary mode starts once the line has been
+	// finished
+	unsigned char bin_request;
+	unsigned char bin_mode;
+	// input taken from the port that the terminal has not had yet, the rest
+	// of a line whose command went on as a task or what followed the frame
+	// that ended binary mode. It is used up before more is read.
+	uint8_t rx[TERM_RX_SIZE];
+	uint8_t rx_start;
+	uint8_t rx_size;
+};
+
+static struct uart_port* const term_ports[TERM_PORTS] = {
+	&uart0,
+#if TERM_PORTS > 1
+	&uart1
+#endif
+};
+
+static struct term terms[TERM_PORTS];
+// the terminal being serviced, its port takes terminal and printf output
+static struct term* term_current = terms;
+// one port at a time can be in binary mode, they would otherwise need a
+// frame buffer each
+static struct mcu_bin term_bin;
+static struct term* term_bin_owner = 0;
+
+static const char banner[] PROGMEM =
+#if !defined(__AVR_ATtiny1634__)
+	"This terminal is connected to the UART0 port of a simulated AVR. This text and the prompt below are printed by the default program, you can load your own program by browsing for a .hex file and hitting the load button above.\r\n\r\n"
+	"There is a copy of this default program as an Atmel Studio project on the AVRjs GitHub page: https://github.com/avrjs it contains UART routines and implements printf to get you started printing things to this terminal.\r\n\r\n"
+	"Bug reports and pull requests are most welcome, please use the AVRjs GitHub page linked in the footer. Thanks!\r\n\r\n"
+#endif
+	"Demo terminal commands:\r\n"
+	"\"gcd a b ...\"\r\n"
+	"where a, b ... are decimal, hex (0x) or octal (0) integers up to 78 digits each, any number of them, this command will print the greatest common divisor of the numbers\r\n"
+	"\"lcm a b ...\"\r\n"
+	"as gcd, this command will print the lowest common multiple of the numbers, a result must fit in 320 bits (any of up to 96 decimal digits does) or is refused as too large\r\n"
+	"\"baud r\"\r\n"
+	"switch UART0 to r baud once everything pending has been sent\r\n"
+	"\"bin\"\r\n"
+	"switch to the binary framed protocol described in mcu_bin.h\r\n"
+	"\"term echo on|off|line\", \"term batch on|off\"\r\n"
+	"turn the echo of typed characters and the prompt off when streaming commands in\r\n";
 
 char term_print_chr(char c)
 {
-	return (uart0_tx((uint8_t*)&c, 1) != 1) ? 0 : -1;
+	return (uart_tx(term_current->uart, (uint8_t*)&c, 1) == 1) ? 0 : -1;
 }
 
-long int gcd(long int a, long int b)
+int term_write(const char* str, size_t size)
 {
-	if (a < 0)
-	{
-		a = -a;
-	}
-	if (b < 0)
-	{
-		b = -b;
-	}
+	return (uart_tx(term_current->uart, (const uint8_t*)str, size) == size) ?
+		0 : -1;
+}
 
-    if (a == 0)
+static void term_select(struct term* const t)
+{
+	term_current = t;
+	printf_port(t->uart);
+	printf_redirect((t->bin_mode != 0) ? &mcu_bin_capture : 0);
+}
+
+// reports the rate that will be used and switches to it, the report goes out
+// at the old rate
+static void baud_cmd_cb(void* arg, size_t argc, char** argv,
+	const int32_t* vals)
+{
+	(void)arg;
+	(void)argc;
+	(void)argv;
+	struct uart_baud baud;
+	if (uart_baud_calc(vals[0], &baud) != 0)
 	{
-		return b;
+		mcu_term_printf_P(PSTR("%ld baud is out of reach\r\n"),
+			(long)vals[0]);
+		return;
 	}
-	if (b == 0)
+	const unsigned int error = (baud.error < 0) ? -baud.error : baud.error;
+	mcu_term_printf_P(PSTR("%lu baud, error %c%u.%02u%%, U2X %u\r\n"),
+		(unsigned long)baud.rate, (baud.error < 0) ? '-' : '+', error / 100,
+		error % 100, baud.u2x);
+	if (error > UART_BAUD_MAX_ERROR)
 	{
-		return a;
-	}
-
-	long int r;
-	while(b != 0)
-	{
-		r = a % b;
-		a = b;
-		b = r;
+		mcu_term_out_P(PSTR("error too large, not switching\r\n"));
+		return;
 	}
-	return a;
+	uart_baud_set(term_current->uart, &baud);
 }
 
-void gcd_cmd_cb(void* arg, size_t argc, char** argv)
+static void bin_cmd_cb(void* arg, size_t argc, char** argv)
 {
-	(void) arg;
-	if (argc != 3)
+	(void)arg;
+	(void)argc;
+	(void)argv;
+	if (term_bin_owner != 0)
 	{
-		printf("Invalid number of args, gcd requires 2\r\n");
+		mcu_term_out_P(PSTR("binary mode is in use on another port\r\n"));
 		return;
 	}
-	char* clamp_str = "%s clamped to %ld to fit into 32 bits\r\n";
-	long int arg0 = strtol(argv[1], 0, 0);
-	if ((arg0 == LONG_MIN) || (arg0 == LONG_MAX))
-	{
-		printf(clamp_str, argv[1], arg0);
-	}
-	long int arg1 = strtol(argv[2], 0, 0);
-	if ((arg1 == LONG_MIN) || (arg1 == LONG_MAX))
+	term_current->bin_request = 1;
+}
+
+// the terminator marks where the text stops and the first reply may start
+static void term_bin_enter(struct term* const t)
+{
+#if defined(AVRJS_RX_LINE_MODE)
+	uart_rx_line_mode(t->uart, 0);
+#endif
+	// frames are binary, XON and XOFF are data
+	uart_flow_control(t->uart, 0);
+	term_write("", 1);
+	term_bin_owner = t;
+	t->bin_request = 0;
+	t->bin_mode = 1;
+	printf_redirect(&mcu_bin_capture);
+}
+
+static void term_bin_exit(struct term* const t)
+{
+	printf_redirect(0);
+	uart_flow_control(t->uart, 1);
+#if defined(AVRJS_RX_LINE_MODE)
+	uart_rx_line_mode(t->uart, 1);
+#endif
+	t->bin_mode = 0;
+	term_bin_owner = 0;
+}
+
+// returns the number of bytes left over for the terminal
+static size_t term_bin_write(struct term* const t, const uint8_t* buffer,
+	size_t n)
+{
+	while (n != 0)
 	{
-		printf(clamp_str, argv[2], arg1);
+		if (mcu_bin_write_char(&term_bin, *buffer) != 0)
+		{ // anything after the exit request is for the terminal
+			term_bin_exit(t);
+			return n - 1;
+		}
+		++buffer;
+		--n;
 	}
+	return 0;
+}
 
-	printf("%ld\r\n", gcd(arg0, arg1));
+#if !defined(AVRJS_RX_LINE_MODE)
+static int term_write_char(struct mcu_term * const mt, const uint8_t c)
+{
+	const unsigned char path = (c == '\r') ? CYCLEBENCH_mcu_term_line :
+		((c >= ' ') ? CYCLEBENCH_mcu_term_write_char : 0);
+	CYCLEBENCH_ENTER(path);
+	const int r = mcu_term_write_char(mt, (char) c);
+	CYCLEBENCH_EXIT(path);
+	return r;
 }
+#endif
 
-void lcm_cmd_cb(void* arg, size_t argc, char** argv)
+// runs a slice of the terminal's command if one is running, otherwise handles
+// whatever has arrived on its port. Returns 1 if there was anything to do, 0
+// if not and -1 if the terminal failed.
+static int term_service(struct term* const t)
 {
-	(void) arg;
-	if (argc != 3)
+	term_select(t);
+	if (mcu_term_busy(&t->mt) != 0)
+	{ // input waits in the rx buffer, XOFF holds the host back if it fills
+		mcu_term_run(&t->mt);
+		return 1;
+	}
+	if (t->rx_size == 0)
 	{
-		printf("Invalid number of args, lcm requires 2\r\n");
-		return;
+		size_t n;
+		if (t->bin_mode != 0)
+		{ // frames are not lines, take whatever has arrived
+			n = uart_rx(t->uart, t->rx, sizeof(t->rx));
+		}
+		else
+		{
+#if defined(AVRJS_RX_LINE_MODE)
+			// the terminal only runs once a whole line has arrived
+			n = uart_rx_line(t->uart, t->rx, sizeof(t->rx));
+#else
+			n = uart_rx(t->uart, t->rx, 1);
+#endif
+		}
+		if (n == 0)
+		{
+			return 0;
+		}
+		t->rx_start = 0;
+		t->rx_size = n;
 	}
-	char* clamp_str = "%s clamped to %ld to fit into 32 bits\r\n";
-	long int arg0 = strtol(argv[1], 0, 0);
-	if ((arg0 == LONG_MIN) || (arg0 == LONG_MAX))
+	// parse chars
+	const uint8_t* const data = t->rx + t->rx_start;
+	size_t used;
+	if (t->bin_mode != 0)
 	{
-		printf(clamp_str, argv[1], arg0);
+		used = t->rx_size - term_bin_write(t, data, t->rx_size);
 	}
-	long int arg1 = strtol(argv[2], 0, 0);
-	if ((arg1 == LONG_MIN) || (arg1 == LONG_MAX))
+	else
 	{
-		printf(clamp_str, argv[2], arg1);
+#if defined(AVRJS_RX_LINE_MODE)
+		// a line at a time, a bin command in it changes what the rest is
+		size_t line = 0;
+		while ((line != t->rx_size) && (data[line++] != UART_RX_LINE_END))
+		{
+		}
+		const int r = mcu_term_write_buf(&t->mt, (const char*)data, line);
+#else
+		const int r = term_write_char(&t->mt, data[0]);
+#endif
+		if (r < 0)
+		{
+			return -1;
+		}
+#if defined(AVRJS_RX_LINE_MODE)
+		// short if a command in the line went on as a task
+		used = (size_t)r;
+#else
+		used = 1;
+#endif
 	}
+	t->rx_start += used;
+	t->rx_size -= used;
+	if (t->bin_request != 0)
+	{
+		term_bin_enter(t);
+	}
+	if ((uart_rx_overflowed(t->uart) != 0) && (t->bin_mode == 0))
+	{ // the host ignored XOFF
+		mcu_term_out_P(PSTR("rx overflow, input lost\r\n"));
+	}
+	return 1;
+}
 
-	long int tmp = (arg0 / gcd(arg0, arg1));
-	long int result = tmp * arg1;
-
-	if (tmp != (result / arg1))
-	{ // overflow
-		printf("overflow detected, result > %ld\r\n", LONG_MAX);
+// called with interrupts disabled
+static unsigned char term_pending(const struct term* const t)
+{
+	if (t->rx_size != 0)
+	{
+		return 1;
 	}
-	else
+#if defined(AVRJS_RX_LINE_MODE)
+	if (t->bin_mode == 0)
 	{
-		printf("%ld\r\n", result);
+		return uart_rx_line_ready(t->uart);
 	}
+#endif
+	return (uart_rx_pending(t->uart) != 0) ? 1 : 0;
 }
 
 int main(void)
 {
 	printf_init();
-
-	sei();
-
-	printf(
-#if !defined(__AVR_ATtiny1634__)
-	"This terminal is connected to the UART0 port of a simulated AVR. This text and the prompt below are printed by the default program, you can load your own program by browsing for a .hex file and hitting the load button above.\r\n\r\n"
-	"There is a copy of this default program as an Atmel Studio project on the AVRjs GitHub page: https://github.com/avrjs it contains UART routines and implements printf to get you started printing things to this terminal.\r\n\r\n"
-	"Bug reports and pull requests are most welcome, please use the AVRjs GitHub page linked in the footer. Thanks!\r\n\r\n"
+	// command output goes where printf would send it
+	mcu_term_set_output(&printf_write);
+#if TERM_PORTS > 1
+	uart_init(&uart1, UART_UBRR_DEFAULT);
 #endif
-	"Demo terminal commands:\r\n"
-	"\"gcd a b\"\r\n"
-	"where a and b are integers, this command will print the greatest common divisor of the 2 numbers providing they can fit in signed 32 bit ints\r\n"
-	"\"lcm a b\"\r\n"
-	"where a and b are integers, this command will print the lowest common multiple of the 2 numbers providing it can fit in a signed 32 bit int\r\n");
-
-	struct mcu_term mt;
-	if (mcu_term_init(&mt, "$", &term_print_chr) != 0)
+	for (size_t i = 0; i < TERM_PORTS; ++i)
 	{
-		return -1;
+		// output is never dropped, uart_tx sleeps until there is room
+		uart_tx_policy(term_ports[i], UART_TX_BLOCK, 0);
+		// pasted scripts are throttled with XOFF instead of overflowing rx
+		uart_flow_control(term_ports[i], 1);
 	}
+	hw_sleep_init();
+
+	hw_irq_enable();
 
-	mcu_term_add_command(&mt, "gcd", &gcd_cmd_cb, 0);
-	mcu_term_add_command(&mt, "lcm", &lcm_cmd_cb, 0);
+	// sent straight from flash, without going through the tx buffer
+	uart_tx_ref_P(&uart0, (const uint8_t*)banner, sizeof(banner) - 1, 0);
 
-	set_sleep_mode(SLEEP_MODE_IDLE);
+	for (size_t i = 0; i < TERM_PORTS; ++i)
+	{
+		struct term* const t = terms + i;
+		t->uart = term_ports[i];
+		t->bin_request = 0;
+		t->bin_mode = 0;
+		t->rx_start = 0;
+		t->rx_size = 0;
+		term_select(t);
+		if (mcu_term_init_P(&t->mt, PSTR("$"), &term_print_chr,
+			&term_write) != 0)
+		{
+			return -1;
+		}
+		mcu_term_set_commands(&t->mt, term_cmds, sizeof(term_cmds) /
+			sizeof(*term_cmds));
+#if defined(AVRJS_RX_LINE_MODE)
+		uart_rx_line_mode(t->uart, 1);
+#endif
+	}
+	// every terminal has the same command table
+	mcu_bin_init(&term_bin, &terms[0].mt, &term_write);
 
+	// each pass gives every terminal one slice of its command or one lot of
+	// input, output drains in the background
     while(1)
     {
-		cli();
-		unsigned char c;
-        if (uart0_rx(&c, 1) > 0)
-		{ // parse char
-			sei();
-			if (mcu_term_write_char(&mt, (char) c) < 0)
+		unsigned char busy = 0;
+		for (size_t i = 0; i < TERM_PORTS; ++i)
+		{
+			const int r = term_service(terms + i);
+			if (r < 0)
 			{
-				mcu_term_destroy(&mt);
+				for (size_t j = 0; j < TERM_PORTS; ++j)
+				{
+					mcu_term_destroy(&terms[j].mt);
+				}
 				return -1;
 			}
+			busy |= r;
 		}
-		else
+		if (busy == 0)
 		{
-			sleep_enable();
-			sei();
-			sleep_cpu();
-			sleep_disable();
+			hw_irq_disable();
+			unsigned char pending = 0;
+			for (size_t i = 0; i < TERM_PORTS; ++i)
+			{
+				pending |= term_pending(terms + i);
+			}
+			if (pending == 0)
+			{ // nothing arrived since the checks above, sleep until it does
+				hw_sleep();
+			}
+			else
+			{
+				hw_irq_enable();
+			}
 		}
     }
 	return 0;
@@ -23,114 +23,651 @@ THE SOFTWARE.
 
 #include "avrjs_uart.h"
 
+#include "avrjs_hw.h"
 #include "cirq.h"
-
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <util/atomic.h>
+#include "cyclebench.h"
 
 #include <stdio.h>
 
-volatile unsigned char _uart0_rx_buffer[UART0_RX_BUFFER_WIDTH];
-volatile unsigned char _uart0_tx_buffer[UART0_TX_BUFFER_WIDTH];
+#if !defined(F_CPU)
+#define F_CPU 16000000UL
+#endif
 
-struct cirq uart0_rx_buffer;
-struct cirq uart0_tx_buffer;
-volatile unsigned char uart0_rx_ovf_flag = 0;
+CIRQ_DEFINE(uart_rx_queue, uint8_t, UART_RX_BUFFER_WIDTH)
+CIRQ_DEFINE(uart_tx_queue, uint8_t, UART_TX_BUFFER_WIDTH)
 
-size_t uart0_rx(uint8_t *const buffer, const size_t size)
+// zero-copy transmit descriptor, see struct uart_port
+struct uart_tx_ref
 {
-	size_t recd = 0;
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	const uint8_t *ptr;
+	uint16_t len;
+	uint8_t flash;
+	uint8_t ring_after;
+	void (*done)(const uint8_t *ptr);
+};
+
+struct uart_port
+{
+	uint8_t port; // index passed to the uart_hw_* functions
+	// the rx queue is filled by the RX ISR and drained by uart_rx, the tx
+	// queue is filled by uart_tx and drained by the UDRE ISR, so neither
+	// needs locking
+	struct uart_rx_queue rx;
+	struct uart_tx_queue tx;
+	volatile unsigned char rx_ovf;
+	// line mode, the RX ISR counts terminators in and uart_rx_line counts
+	// them out, each side only writes its own counter
+	volatile uint8_t line_mode;
+	volatile uint8_t lines_in;
+	volatile uint8_t lines_out;
+	// software flow control. flow_ctrl_out is a control character the UDRE
+	// ISR sends ahead of any data, flow_xoff_sent is set while the host has
+	// been told to stop and flow_tx_paused while the host has told us to.
+	volatile uint8_t flow_enabled;
+	volatile uint8_t flow_ctrl_out;
+	volatile uint8_t flow_xoff_sent;
+	volatile uint8_t flow_tx_paused;
+	uint8_t flow_high;
+	uint8_t flow_low;
+	// zero-copy transmit descriptors, filled by uart_tx_ref and streamed by
+	// the UDRE ISR. To keep output in order with uart_tx, tx_ring_lead holds
+	// the number of buffered bytes to send before the head descriptor and
+	// each descriptor counts the buffered bytes queued after it. These counts
+	// are bounded by the tx buffer width.
+	struct uart_tx_ref tx_refs[UART_TX_REF_DEPTH];
+	volatile uint8_t tx_ref_head;
+	volatile uint8_t tx_ref_tail;
+	volatile uint8_t tx_ring_lead;
+	uint16_t tx_ref_pos; // UDRE ISR only
+	// set once the UDRE ISR has written a byte, until then TXC never sets
+	volatile uint8_t tx_written;
+	enum uart_tx_policy tx_policy;
+	uint16_t tx_timeout;
+	struct uart_tx_stats tx_stats;
+};
+
+struct uart_port uart0 = { .port = 0 };
+#if UART_PORTS > 1
+struct uart_port uart1 = { .port = 1 };
+#endif
+
+// sends XON once the rx buffer has drained to the low watermark
+static void uart_flow_rx_drained(struct uart_port *const u)
+{
+	if ((u->flow_xoff_sent != 0) &&
+		(uart_rx_queue_population(&u->rx) <= u->flow_low))
 	{
-		while ((cirq_empty(&uart0_rx_buffer) == 0) && (recd < size))
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			buffer[recd] = cirq_pop_front(&uart0_rx_buffer);
-			++recd;
+			u->flow_xoff_sent = 0;
+			u->flow_ctrl_out = UART_XON;
 		}
+		uart_hw_udrie_enable(u->port);
 	}
+}
+
+size_t uart_rx(struct uart_port *const u, uint8_t *const buffer,
+	const size_t size)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_uart_rx);
+	const size_t recd = uart_rx_queue_pop_n(&u->rx, buffer, size);
+	uart_flow_rx_drained(u);
+	CYCLEBENCH_EXIT(CYCLEBENCH_uart_rx);
 	return recd;
 }
 
-size_t uart0_tx(const uint8_t *const data, const size_t size)
+void uart_tx_policy(struct uart_port *const u,
+	const enum uart_tx_policy policy, const uint16_t timeout)
+{
+	u->tx_policy = policy;
+	u->tx_timeout = timeout;
+}
+
+const struct uart_tx_stats *uart_tx_stats(const struct uart_port *const u)
+{
+	return &u->tx_stats;
+}
+
+unsigned char uart_rx_overflowed(struct uart_port *const u)
+{
+	const unsigned char ovf = u->rx_ovf;
+	u->rx_ovf = 0;
+	return ovf;
+}
+
+static inline uint8_t uart_tx_refs_population(const struct uart_port *const u)
+{
+	return (uint8_t)(u->tx_ref_tail - u->tx_ref_head);
+}
+
+// queues into the tx buffer, accounting for descriptors still in flight
+static size_t uart_tx_push(struct uart_port *const u,
+	const uint8_t *const data, const size_t size)
+{
+	const size_t n = uart_tx_queue_push_n(&u->tx, data, size);
+	if ((n != 0) && (uart_tx_refs_population(u) != 0))
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{ // recheck, the ISR may have retired the last descriptor
+			if (uart_tx_refs_population(u) != 0)
+			{
+				u->tx_refs[(uint8_t)(u->tx_ref_tail - 1) &
+					(UART_TX_REF_DEPTH - 1)].ring_after += n;
+			}
+		}
+	}
+	// enable after publishing tail, if the ISR disabled itself in between
+	// this turns it back on
+	uart_hw_udrie_enable(u->port);
+	return n;
+}
+
+// sleeps until the UDRE ISR has made room, gives up after tx_timeout
+// consecutive wake-ups without progress under UART_TX_BLOCK_TIMEOUT
+static size_t uart_tx_wait(struct uart_port *const u,
+	const uint8_t *const data, const size_t size)
 {
 	size_t sent = 0;
+	uint16_t idle = 0;
+	while (sent < size)
+	{
+		hw_irq_disable();
+		if (uart_tx_queue_space(&u->tx) == 0)
+		{
+			if ((u->tx_policy == UART_TX_BLOCK_TIMEOUT) &&
+				(idle == u->tx_timeout))
+			{
+				hw_irq_enable();
+				++u->tx_stats.timeouts;
+				break;
+			}
+			hw_sleep();
+			++u->tx_stats.waits;
+			++idle;
+		}
+		else
+		{
+			hw_irq_enable();
+		}
+		const size_t n = uart_tx_push(u, data + sent, size - sent);
+		if (n != 0)
+		{
+			idle = 0;
+			sent += n;
+		}
+	}
+	return sent;
+}
+
+size_t uart_tx(struct uart_port *const u, const uint8_t *const data,
+	const size_t size)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_uart_tx);
+	size_t sent = uart_tx_push(u, data, size);
+	// blocking with interrupts off (from an ISR) would never return, drop
+	if ((sent != size) && (u->tx_policy != UART_TX_DROP) &&
+		(hw_irq_enabled() != 0))
+	{
+		sent += uart_tx_wait(u, data + sent, size - sent);
+	}
+	u->tx_stats.dropped += size - sent;
+	CYCLEBENCH_EXIT(CYCLEBENCH_uart_tx);
+	return sent;
+}
+
+static int uart_tx_ref_enqueue(struct uart_port *const u,
+	const uint8_t *const ptr, const uint16_t len, const uint8_t flash,
+	void (*const done)(const uint8_t *ptr))
+{
+	if (len == 0)
+	{
+		return -1;
+	}
+	if (uart_tx_refs_population(u) == UART_TX_REF_DEPTH)
+	{
+		if ((u->tx_policy == UART_TX_DROP) || (hw_irq_enabled() == 0))
+		{
+			u->tx_stats.dropped += len;
+			return -1;
+		}
+		uint16_t idle = 0;
+		while (1)
+		{
+			hw_irq_disable();
+			if (uart_tx_refs_population(u) != UART_TX_REF_DEPTH)
+			{
+				hw_irq_enable();
+				break;
+			}
+			if ((u->tx_policy == UART_TX_BLOCK_TIMEOUT) &&
+				(idle == u->tx_timeout))
+			{
+				hw_irq_enable();
+				++u->tx_stats.timeouts;
+				u->tx_stats.dropped += len;
+				return -1;
+			}
+			hw_sleep();
+			++u->tx_stats.waits;
+			++idle;
+		}
+	}
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		while (cirq_space(&uart0_tx_buffer) && (sent < size))
+		const uint8_t tail = u->tx_ref_tail;
+		struct uart_tx_ref *const ref =
+			u->tx_refs + (tail & (UART_TX_REF_DEPTH - 1));
+		ref->ptr = ptr;
+		ref->len = len;
+		ref->flash = flash;
+		ref->ring_after = 0;
+		ref->done = done;
+		if (uart_tx_refs_population(u) == 0)
+		{ // everything buffered so far goes first
+			u->tx_ring_lead = uart_tx_queue_population(&u->tx);
+		}
+		u->tx_ref_tail = (uint8_t)(tail + 1);
+	}
+	uart_hw_udrie_enable(u->port);
+	return 0;
+}
+
+int uart_tx_ref(struct uart_port *const u, const uint8_t *const ptr,
+	const uint16_t len, void (*const done)(const uint8_t *ptr))
+{
+	return uart_tx_ref_enqueue(u, ptr, len, 0, done);
+}
+
+int uart_tx_ref_P(struct uart_port *const u, const uint8_t *const ptr_P,
+	const uint16_t len, void (*const done)(const uint8_t *ptr))
+{
+	return uart_tx_ref_enqueue(u, ptr_P, len, 1, done);
+}
+
+// copies from flash through a small stack buffer, returns the number of bytes
+// queued which is short if the tx buffer fills
+size_t uart_tx_P(struct uart_port *const u, const uint8_t *const data_P,
+	const size_t size)
+{
+	uint8_t chunk[16];
+	size_t sent = 0;
+	while (sent < size)
+	{
+		size_t n = size - sent;
+		if (n > sizeof(chunk))
 		{
-			cirq_push_back(&uart0_tx_buffer, data[sent]);
-			++sent;
+			n = sizeof(chunk);
+		}
+		memcpy_P(chunk, data_P + sent, n);
+		const size_t queued = uart_tx(u, chunk, n);
+		sent += queued;
+		if (queued != n)
+		{ // uart_tx counted the rest of this chunk
+			u->tx_stats.dropped += size - sent - (n - queued);
+			break;
 		}
 	}
-	UCSR0B |= (1 << UDRIE0); // enable UDR empty interrupt
 	return sent;
 }
 
-void uart0_init(const uint16_t brr)
+void uart_rx_line_mode(struct uart_port *const u, const unsigned char enable)
 {
-	uart0_rx_buffer = cirq_init(UART0_RX_BUFFER_WIDTH, _uart0_rx_buffer);
-	uart0_tx_buffer = cirq_init(UART0_TX_BUFFER_WIDTH, _uart0_tx_buffer);
-	UBRR0H = (uint8_t)(brr >> 8); // setup baud rate register
-	UBRR0L = (uint8_t)brr;
+	u->line_mode = 0;
+	u->lines_out = u->lines_in;
+	u->line_mode = enable;
+}
 
-	UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0); // enable rx and tx, enable rx interrupt
-	UCSR0C = (1 << USBS0) | (3 << UCSZ00); // 8N1
+// a buffer filled to the XOFF mark counts as full, a host that honours XOFF
+// never sends the rest
+unsigned char uart_rx_line_ready(const struct uart_port *const u)
+{
+	return ((u->lines_in != u->lines_out) ||
+		(uart_rx_queue_space(&u->rx) == 0) || ((u->flow_enabled != 0) &&
+		(uart_rx_queue_population(&u->rx) >= u->flow_high))) ? 1 : 0;
 }
 
-void uart0_destroy(void)
+size_t uart_rx_line(struct uart_port *const u, uint8_t *const buffer,
+	const size_t size)
 {
-	UBRR0H = 0x00;
-	UBRR0L = 0x00;
+	if (uart_rx_line_ready(u) == 0)
+	{
+		return 0;
+	}
+	// a full buffer without a terminator is handed over as it is, otherwise
+	// a line longer than the buffer could never complete. Everything queued
+	// is copied out in one go and only the line is taken off the queue.
+	const size_t queued = uart_rx_queue_peek_n(&u->rx, 0, buffer, size);
+	size_t recd = 0;
+	while (recd < queued)
+	{
+		++recd;
+		if (buffer[recd - 1] == UART_RX_LINE_END)
+		{
+			++u->lines_out;
+			break;
+		}
+	}
+	uart_rx_queue_discard_n(&u->rx, recd);
+	uart_flow_rx_drained(u);
+	return recd;
+}
 
-	UCSR0A = 0x20;
-	UCSR0B = 0x00;
-	UCSR0C = 0x06;
+size_t uart_rx_pending(const struct uart_port *const u)
+{
+	return uart_rx_queue_population(&u->rx);
 }
 
-#if defined(__AVR_ATmega328__)
-ISR (USART_UDRE_vect)
-#else
-ISR (USART0_UDRE_vect)
-#endif
+void uart_flow_control(struct uart_port *const u, const unsigned char enable)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if ((enable == 0) && (u->flow_xoff_sent != 0))
+		{ // don't leave the host stopped
+			u->flow_ctrl_out = UART_XON;
+		}
+		u->flow_xoff_sent = 0;
+		u->flow_tx_paused = 0;
+		u->flow_enabled = enable;
+	}
+	uart_hw_udrie_enable(u->port);
+}
+
+void uart_flow_watermarks(struct uart_port *const u, const uint8_t high,
+	const uint8_t low)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		u->flow_high = high;
+		u->flow_low = low;
+	}
+}
+
+// one of the two sampling modes, -1 if the divisor doesn't fit in 12 bits
+static int uart_baud_mode(const uint32_t rate, const uint8_t u2x,
+	struct uart_baud *const baud)
 {
-	if(cirq_empty(&uart0_tx_buffer) == 0)
+	const uint32_t clocks = (u2x != 0) ? 8 : 16;
+	const uint32_t div = (F_CPU + ((clocks * rate) >> 1)) / (clocks * rate);
+	if ((div == 0) || (div > 4096))
 	{
-		UDR0 = cirq_pop_front(&uart0_tx_buffer);
+		return -1;
+	}
+	baud->ubrr = (uint16_t)(div - 1);
+	baud->u2x = u2x;
+	baud->rate = F_CPU / (clocks * div);
+	const int32_t error = ((int32_t)baud->rate - (int32_t)rate) * 100 /
+		(int32_t)(rate / 100);
+	baud->error = (error > INT16_MAX) ? INT16_MAX :
+		((error < INT16_MIN) ? INT16_MIN : (int16_t)error);
+	return 0;
+}
+
+int uart_baud_calc(const uint32_t rate, struct uart_baud *const baud)
+{
+	if ((rate < 100) || (rate > F_CPU / 8))
+	{
+		return -1;
+	}
+	struct uart_baud u2x;
+	const int normal_r = uart_baud_mode(rate, 0, baud);
+	if (uart_baud_mode(rate, 1, &u2x) != 0)
+	{
+		return normal_r;
+	}
+	// U2X halves the receiver's sampling margin, only use it when it helps
+	if ((normal_r != 0) ||
+		(abs(u2x.error) < abs(baud->error)))
+	{
+		*baud = u2x;
+	}
+	return 0;
+}
+
+int uart_baud_set(struct uart_port *const u,
+	const struct uart_baud *const baud)
+{
+	if (hw_irq_enabled() == 0)
+	{
+		return -1;
+	}
+	while (1)
+	{ // let the UDRE ISR empty the tx buffer, descriptors and control chars
+		hw_irq_disable();
+		if ((uart_tx_queue_empty(&u->tx) != 0) &&
+			(uart_tx_refs_population(u) == 0) && (u->flow_ctrl_out == 0))
+		{
+			hw_irq_enable();
+			break;
+		}
+		hw_sleep();
+	}
+	// the last byte may still be in UDR or the shift register
+	while ((u->tx_written != 0) && (uart_hw_tx_complete(u->port) == 0))
+	{
+	}
+	uart_hw_baud(u->port, baud->ubrr, baud->u2x);
+	return 0;
+}
+
+void uart_init(struct uart_port *const u, const uint16_t brr)
+{
+	uart_rx_queue_init(&u->rx);
+	uart_tx_queue_init(&u->tx);
+	u->rx_ovf = 0;
+	u->line_mode = 0;
+	u->lines_in = 0;
+	u->lines_out = 0;
+	u->flow_enabled = 0;
+	u->flow_ctrl_out = 0;
+	u->flow_xoff_sent = 0;
+	u->flow_tx_paused = 0;
+	u->flow_high = UART_RX_XOFF_HIGH;
+	u->flow_low = UART_RX_XON_LOW;
+	u->tx_ref_head = 0;
+	u->tx_ref_tail = 0;
+	u->tx_ring_lead = 0;
+	u->tx_ref_pos = 0;
+	u->tx_written = 0;
+	u->tx_policy = UART_TX_DROP;
+	u->tx_timeout = 0;
+	uart_hw_init(u->port, brr);
+}
+
+void uart_destroy(struct uart_port *const u)
+{
+	uart_hw_destroy(u->port);
+}
+
+// the ISR bodies are shared by every port and forced inline into each port's
+// vectors, so an interrupt makes no calls and the port index is a constant
+static HW_ALWAYS_INLINE void uart_udre_isr(struct uart_port *const u)
+{
+	CYCLEBENCH_ENTER(CYCLEBENCH_uart_udre_isr);
+	const uint8_t ref_head = u->tx_ref_head;
+	if (u->flow_ctrl_out != 0)
+	{ // flow control goes ahead of everything, even while paused
+		uart_hw_write(u->port, u->flow_ctrl_out);
+		u->flow_ctrl_out = 0;
+		u->tx_written = 1;
+	}
+	else if (u->flow_tx_paused != 0)
+	{ // re-enabled when the host sends XON
+		uart_hw_udrie_disable(u->port);
+	}
+	else if ((ref_head != u->tx_ref_tail) && (u->tx_ring_lead == 0))
+	{ // stream straight from the descriptor
+		struct uart_tx_ref *const ref =
+			u->tx_refs + (ref_head & (UART_TX_REF_DEPTH - 1));
+		const uint8_t *const p = ref->ptr + u->tx_ref_pos;
+		uart_hw_write(u->port, (ref->flash != 0) ? pgm_read_byte(p) : *p);
+		u->tx_written = 1;
+		if (++u->tx_ref_pos == ref->len)
+		{
+			u->tx_ref_pos = 0;
+			u->tx_ring_lead = ref->ring_after;
+			void (*const done)(const uint8_t *ptr) = ref->done;
+			const uint8_t *const ptr = ref->ptr;
+			u->tx_ref_head = (uint8_t)(ref_head + 1);
+			if (done != 0)
+			{
+				done(ptr);
+			}
+		}
+	}
+	else if(uart_tx_queue_empty(&u->tx) == 0)
+	{
+		if (ref_head != u->tx_ref_tail)
+		{
+			--u->tx_ring_lead;
+		}
+		uart_hw_write(u->port, uart_tx_queue_pop_front(&u->tx));
+		u->tx_written = 1;
 	}
 	else
 	{
-		UCSR0B &= ~(1 << UDRIE0); // disable UDR empty interrupt
+		uart_hw_udrie_disable(u->port);
 	}
+	CYCLEBENCH_EXIT(CYCLEBENCH_uart_udre_isr);
 }
 
-#if defined(__AVR_ATmega328__)
-ISR (USART_RX_vect)
-#else
-ISR (USART0_RX_vect)
-#endif
+static HW_ALWAYS_INLINE void uart_rx_isr(struct uart_port *const u)
 {
-	if (cirq_space(&uart0_rx_buffer) != 0)
+	CYCLEBENCH_ENTER(CYCLEBENCH_uart_rx_isr);
+	const uint8_t c = uart_hw_read(u->port);
+	if ((u->flow_enabled != 0) && ((c == UART_XOFF) || (c == UART_XON)))
+	{
+		u->flow_tx_paused = (c == UART_XOFF) ? 1 : 0;
+		if (c == UART_XON)
+		{
+			uart_hw_udrie_enable(u->port);
+		}
+	}
+	else if (uart_rx_queue_space(&u->rx) != 0)
 	{
-		cirq_push_back(&uart0_rx_buffer, UDR0);
+		uart_rx_queue_push_back(&u->rx, c);
+		if ((c == UART_RX_LINE_END) && (u->line_mode != 0))
+		{
+			++u->lines_in;
+		}
+		if ((u->flow_enabled != 0) && (u->flow_xoff_sent == 0) &&
+			(uart_rx_queue_population(&u->rx) >= u->flow_high))
+		{
+			u->flow_xoff_sent = 1;
+			u->flow_ctrl_out = UART_XOFF;
+			uart_hw_udrie_enable(u->port);
+		}
 	}
 	else
 	{
-		volatile uint8_t n = UDR0;
-		(void) n;
-		uart0_rx_ovf_flag = 1;
+		u->rx_ovf = 1;
+	}
+	CYCLEBENCH_EXIT(CYCLEBENCH_uart_rx_isr);
+}
+
+#if defined(__AVR__)
+ISR (UART0_UDRE_vect)
+{
+	uart_udre_isr(&uart0);
+}
+
+ISR (UART0_RX_vect)
+{
+	uart_rx_isr(&uart0);
+}
+
+#if UART_PORTS > 1
+ISR (UART1_UDRE_vect)
+{
+	uart_udre_isr(&uart1);
+}
+
+ISR (UART1_RX_vect)
+{
+	uart_rx_isr(&uart1);
+}
+#endif
+#else
+void uart0_udre_isr(void)
+{
+	uart_udre_isr(&uart0);
+}
+
+void uart0_rx_isr(void)
+{
+	uart_rx_isr(&uart0);
+}
+
+#if UART_PORTS > 1
+void uart1_udre_isr(void)
+{
+	uart_udre_isr(&uart1);
+}
+
+void uart1_rx_isr(void)
+{
+	uart_rx_isr(&uart1);
+}
+#endif
+#endif
+
+// the port stdout writes to and, set by printf_redirect, a sink that takes
+// printf output instead
+static struct uart_port *printf_uart = &uart0;
+static int (*printf_sink)(const char *str, size_t size) = 0;
+
+void printf_port(struct uart_port *const u)
+{
+	printf_uart = u;
+}
+
+void printf_redirect(int (*const sink)(const char *str, size_t size))
+{
+	printf_sink = sink;
+}
+
+int printf_write(const char *const str, const size_t size)
+{
+	if (printf_sink != 0)
+	{
+		return printf_sink(str, size);
 	}
+#if defined(__AVR__)
+	return (uart_tx(printf_uart, (const uint8_t*)str, size) == size) ? 0 : -1;
+#else
+	size_t sent = 0;
+	while (sent < size)
+	{ // the host port drains the tx buffer synchronously
+		sent += uart_tx(printf_uart, (const uint8_t*)str + sent, size - sent);
+	}
+	return 0;
+#endif
 }
 
+#if defined(__AVR__)
 static int uart_putchar_printf(char var, FILE *stream)
 {
 	(void)stream;
-	return (uart0_tx((uint8_t*)&var, 1) != 1) ? 0 : -1;
+	return printf_write(&var, 1);
 }
 
 void printf_init(void)
 {
-	uart0_init(1);
+	uart_init(&uart0, UART_UBRR_DEFAULT);
 	static FILE mystdout = FDEV_SETUP_STREAM(uart_putchar_printf, NULL, _FDEV_SETUP_WRITE);
 	stdout = &mystdout;
 }
+#else
+static ssize_t uart_write_printf(void *cookie, const char *buf, size_t size)
+{
+	(void)cookie;
+	return (printf_write(buf, size) == 0) ? (ssize_t)size : -1;
+}
+
+void printf_init(void)
+{
+	uart_init(&uart0, UART_UBRR_DEFAULT);
+	static const cookie_io_functions_t io = { .write = &uart_write_printf };
+	stdout = fopencookie(NULL, "w", io);
+	setvbuf(stdout, NULL, _IONBF, 0);
+}
+#endif
@@ -21,22 +21,120 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+
 #ifndef AVRJS_UART_H
 #define AVRJS_UART_H
 
+#include "avrjs_hw.h"
+
 #include <stdlib.h>
 #include <stdint.h>
 
-#define UART0_RX_BUFFER_WIDTH 64
-#define UART0_TX_BUFFER_WIDTH 64
+// every port has rings of these widths, powers of two no larger than 128 use
+// mask arithmetic, see CIRQ_DEFINE
+#define UART_RX_BUFFER_WIDTH 64
+#define UART_TX_BUFFER_WIDTH 64
+// terminator counted by the RX ISR in line mode
+#define UART_RX_LINE_END '\r'
+// zero-copy transmit descriptors in flight per port, a power of two
+#define UART_TX_REF_DEPTH 4
+// software flow control characters and default rx buffer watermarks, XOFF is
+// sent when the rx buffer fills to the high mark and XON once it drains to the
+// low mark. The margin above the high mark covers what a host sends before it
+// reacts.
+#define UART_XON 0x11
+#define UART_XOFF 0x13
+#define UART_RX_XOFF_HIGH (UART_RX_BUFFER_WIDTH - 16)
+#define UART_RX_XON_LOW (UART_RX_BUFFER_WIDTH / 4)
+// divisor set by printf_init, F_CPU / 32 baud (500k at 16 MHz)
+#define UART_UBRR_DEFAULT 1
+// largest rate error in hundredths of a percent the baud command accepts
+#define UART_BAUD_MAX_ERROR 200
+
+// what uart_tx does when the tx buffer is full
+enum uart_tx_policy
+{
+	UART_TX_DROP, // return a short count straight away
+	UART_TX_BLOCK, // sleep until the UDRE ISR has made room for everything
+	UART_TX_BLOCK_TIMEOUT // as above, give up after timeout idle wake-ups
+};
+
+struct uart_tx_stats
+{
+	uint32_t dropped; // bytes not queued
+	uint32_t waits; // wake-ups spent waiting for room, roughly byte times
+	uint32_t timeouts; // calls that gave up under UART_TX_BLOCK_TIMEOUT
+};
+
+// line settings for a requested rate, error is the actual rate's deviation
+// from it in hundredths of a percent
+struct uart_baud
+{
+	uint32_t rate; // actual
+	int16_t error;
+	uint16_t ubrr;
+	uint8_t u2x;
+};
+
+// one per hardware port (UART_PORTS of them, see avrjs_hw.h), private to
+// avrjs_uart.c. Each has its own rings, state and ISRs.
+struct uart_port;
+
+extern struct uart_port uart0;
+#if UART_PORTS > 1
+extern struct uart_port uart1;
+#endif
 
-extern volatile unsigned char uart0_rx_ovf_flag;
+void uart_tx_policy(struct uart_port *const u,
+	const enum uart_tx_policy policy, const uint16_t timeout);
+const struct uart_tx_stats *uart_tx_stats(const struct uart_port *const u);
+// returns whether input was lost since the last call, and clears the flag
+unsigned char uart_rx_overflowed(struct uart_port *const u);
 
-size_t uart0_rx(uint8_t *const buffer, const size_t size);
-size_t uart0_tx(const uint8_t *const data, const size_t size);
-void uart0_init(uint16_t brr);
-void uart0_destroy(void);
+size_t uart_rx(struct uart_port *const u, uint8_t *const buffer,
+	const size_t size);
+size_t uart_tx(struct uart_port *const u, const uint8_t *const data,
+	const size_t size);
+size_t uart_tx_P(struct uart_port *const u, const uint8_t *const data_P,
+	const size_t size);
+// transmit len bytes straight from ptr without copying, ptr must stay valid
+// until done (which may be null) is called from the UDRE ISR. Returns -1 if
+// the descriptor queue stays full under the tx policy.
+int uart_tx_ref(struct uart_port *const u, const uint8_t *const ptr,
+	const uint16_t len, void (*const done)(const uint8_t *ptr));
+int uart_tx_ref_P(struct uart_port *const u, const uint8_t *const ptr_P,
+	const uint16_t len, void (*const done)(const uint8_t *ptr));
+size_t uart_rx_pending(const struct uart_port *const u);
+// line mode, don't mix uart_rx_line with uart_rx. uart_rx_line returns 0
+// until a whole line is available, or the rx buffer is full (up to the XOFF
+// mark with flow control on), then up to size bytes of it including the
+// terminator.
+void uart_rx_line_mode(struct uart_port *const u, const unsigned char enable);
+unsigned char uart_rx_line_ready(const struct uart_port *const u);
+size_t uart_rx_line(struct uart_port *const u, uint8_t *const buffer,
+	const size_t size);
+// XON/XOFF both ways, off by default. While on, XON and XOFF from the host
+// pause and resume transmission and are not passed on as data. Turning it off
+// sends XON if the host had been told to stop.
+void uart_flow_control(struct uart_port *const u, const unsigned char enable);
+void uart_flow_watermarks(struct uart_port *const u, const uint8_t high,
+	const uint8_t low);
+// uart_baud_calc computes the divisor for rate from F_CPU, using U2X where
+// that is closer, and returns -1 if the rate is out of reach. uart_baud_set
+// waits for everything queued on the port to be sent before switching, it
+// returns -1 if called with interrupts disabled.
+int uart_baud_calc(const uint32_t rate, struct uart_baud *const baud);
+int uart_baud_set(struct uart_port *const u,
+	const struct uart_baud *const baud);
+void uart_init(struct uart_port *const u, const uint16_t brr);
+void uart_destroy(struct uart_port *const u);
 
+// stdout on uart0, printf_port moves it to another port
 void printf_init(void);
+void printf_port(struct uart_port *const u);
+// sends printf output to sink instead of the port, null restores the port
+void printf_redirect(int (*const sink)(const char *str, size_t size));
+// writes to where printf output goes, returns 0 if all of it was taken
+int printf_write(const char *const str, const size_t size);
 
-#endif
\ No newline at end of file
+#endif
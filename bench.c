@@ -0,0 +1,663 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// host throughput benchmark for mcu_term. Replays a command script (or a
+// generated one if no file is given) through mcu_term_write_char and reports
+// chars/sec, commands/sec and heap allocations per command. The same commands
+// are then sent as mcu_bin frames and the wire bytes of both are compared, the
+// gcd and lcm kernels are timed against the Euclid ones they replaced and the
+// mcu_term output calls against snprintf. The allocator is
+// counted by linking with -Wl,--wrap=malloc,--wrap=realloc,--wrap=free.
+
+#include "avrjs_cmds.h"
+#include "mcu_bin.h"
+#include "mcu_term.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_GENERATED_SIZE (4ul * 1024ul * 1024ul)
+#define BENCH_BIN_COMMANDS 1000000ul
+#define BENCH_GCD_PAIRS 4096ul
+#define BENCH_GCD_ROUNDS 256ul
+#define BENCH_OUT_LINES 4000000ul
+
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static unsigned long bench_allocs = 0;
+static unsigned long bench_frees = 0;
+static unsigned long bench_echoed = 0;
+static unsigned long bench_dispatched = 0;
+static unsigned long bench_wire_out = 0;
+static unsigned long bench_bin_replies = 0;
+static unsigned long bench_bin_errors = 0;
+// the text side's output for the command being run, to check its reply
+static char bench_text_out[128];
+static size_t bench_text_out_population = 0;
+static uint8_t bench_bin_reply[MCU_BIN_ENCODED_SIZE(2 + MCU_BIN_REPLY_SIZE)];
+static size_t bench_bin_reply_population = 0;
+
+void* __wrap_malloc(size_t size)
+{
+	++bench_allocs;
+	return __real_malloc(size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+	++bench_allocs;
+	return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr)
+{
+	if (ptr != NULL)
+	{
+		++bench_frees;
+	}
+	__real_free(ptr);
+}
+
+static char bench_print(char c)
+{
+	(void)c;
+	++bench_echoed;
+	return 0;
+}
+
+static int bench_write(const char* str, size_t size)
+{
+	(void)str;
+	bench_echoed += size;
+	return 0;
+}
+
+// stands in for the UART in the binary runs, decodes and checks each reply
+static int bench_bin_write(const char* str, size_t size)
+{
+	bench_wire_out += size;
+	while (size != 0)
+	{
+		const uint8_t c = (uint8_t)*str;
+		if (c != 0)
+		{
+			if (bench_bin_reply_population < sizeof(bench_bin_reply))
+			{
+				bench_bin_reply[bench_bin_reply_population] = c;
+			}
+			++bench_bin_reply_population;
+		}
+		else
+		{
+			const int n = (bench_bin_reply_population >
+				sizeof(bench_bin_reply)) ? -1 : mcu_bin_decode(bench_bin_reply,
+				bench_bin_reply, bench_bin_reply_population);
+			if ((n < 2) || (bench_bin_reply[1] != MCU_BIN_OK))
+			{
+				++bench_bin_errors;
+			}
+			++bench_bin_replies;
+			bench_bin_reply_population = 0;
+		}
+		++str;
+		--size;
+	}
+	return 0;
+}
+
+static int bench_text_write(const char* str, size_t size)
+{
+	bench_wire_out += size;
+	while (size != 0)
+	{
+		if (bench_text_out_population < sizeof(bench_text_out) - 1)
+		{
+			bench_text_out[bench_text_out_population] = *str;
+			++bench_text_out_population;
+		}
+		++str;
+		--size;
+	}
+	bench_text_out[bench_text_out_population] = 0;
+	return 0;
+}
+
+static char bench_text_print(char c)
+{
+	bench_text_write(&c, 1);
+	return 0;
+}
+
+// command output that is not being measured
+static int bench_discard(const char* str, size_t size)
+{
+	(void)str;
+	(void)size;
+	return 0;
+}
+
+static void nop_cmd_cb(void* arg, size_t argc, char** argv)
+{
+	(void)arg;
+	(void)argc;
+	(void)argv;
+	++bench_dispatched;
+}
+
+static const struct mcu_term_schema dyn_schema = {
+	0, MCU_TERM_TYPED_ARGS, 0, INT32_MIN, INT32_MAX
+};
+
+static void dyn_cmd_cb(void* arg, size_t argc, char** argv,
+	const int32_t* vals)
+{
+	(void)arg;
+	(void)argc;
+	(void)argv;
+	(void)vals;
+	++bench_dispatched;
+}
+
+static void* gcd_bench_begin(void* arg)
+{
+	++bench_dispatched;
+	return gcd_begin_cb(arg);
+}
+
+static void* lcm_bench_begin(void* arg)
+{
+	++bench_dispatched;
+	return lcm_begin_cb(arg);
+}
+
+static const struct mcu_term_stream gcd_bench_stream = {
+	&gcd_bench_begin, &gcd_token_cb, &gcd_end_cb
+};
+static const struct mcu_term_stream lcm_bench_stream = {
+	&lcm_bench_begin, &gcd_token_cb, &gcd_end_cb
+};
+
+// sorted by name, as in the firmware
+static const struct mcu_term_const_cmd bench_cmds[] = {
+	{ "gcd", 0, 0, 0, 0, &gcd_bench_stream },
+	{ "lcm", 0, 0, 0, 0, &lcm_bench_stream },
+	{ "nop", &nop_cmd_cb, 0, 0, 0, 0 }
+};
+
+static char* bench_generate(size_t* const size)
+{
+	static const char* const lines[] = {
+		"gcd 1071 462\r",
+		"lcm 21 6\r",
+		"gcd -2147483647 65536\r",
+		"lcm 0x7fff 0x1fff\r",
+		"lcm 4294967296 3 5 7 11 13\r",
+		"gcd 0x123456789abcdef0123456789 0xfedcba9876543210fedcba98\r",
+		"lcm 2 3 5 7 11 13 17 19 23 29 31 37 41 43 47 53 59 61 67 71 73 79 83 "
+		"89 97 101 103 107 109 113\r",
+		"nop a bb ccc dddd eeeee ffffff ggggggg hhhhhhhh\r",
+		"unknown command with   extra   spaces\r",
+		"dyn 1 2 3\r",
+		"gcd 12 1\b8\r",
+		"\r"
+	};
+	char* const script = malloc(BENCH_GENERATED_SIZE);
+	if (script == NULL)
+	{
+		return NULL;
+	}
+	size_t population = 0;
+	size_t i = 0;
+	while (1)
+	{
+		const char* const line = lines[i % (sizeof(lines) / sizeof(*lines))];
+		size_t len = strlen(line);
+		if (population + len > BENCH_GENERATED_SIZE)
+		{
+			break;
+		}
+		memcpy(script + population, line, len);
+		population += len;
+		++i;
+	}
+	*size = population;
+	return script;
+}
+
+static char* bench_load(const char* const path, size_t* const size)
+{
+	FILE* const f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return NULL;
+	}
+	char* script = NULL;
+	size_t population = 0;
+	size_t capacity = 0;
+	while (1)
+	{
+		if (population == capacity)
+		{
+			capacity = (capacity == 0) ? 65536 : capacity * 2;
+			char* const tmp = realloc(script, capacity);
+			if (tmp == NULL)
+			{
+				free(script);
+				fclose(f);
+				return NULL;
+			}
+			script = tmp;
+		}
+		size_t n = fread(script + population, 1, capacity - population, f);
+		if (n == 0)
+		{
+			break;
+		}
+		population += n;
+	}
+	fclose(f);
+	for (size_t i = 0; i < population; ++i)
+	{ // scripts are usually written with unix line endings
+		if (script[i] == '\n')
+		{
+			script[i] = '\r';
+		}
+	}
+	*size = population;
+	return script;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// feeds the script a character at a time, or in chunks of up to chunk bytes
+// through mcu_term_write_buf, and reports the throughput. Output goes through
+// write if it is set, otherwise a character at a time through print. quiet
+// turns the echo and the prompt off as a streaming script would.
+static int bench_run(const char* const name, const char* const script,
+	const size_t size, const size_t lines, const size_t chunk,
+	int (* const write)(const char*, size_t), const int quiet)
+{
+	struct mcu_term mt;
+	if (mcu_term_init(&mt, "$", &bench_print, write) != 0)
+	{
+		return -1;
+	}
+	if (mcu_term_set_commands(&mt, bench_cmds,
+		sizeof(bench_cmds) / sizeof(*bench_cmds)) != 0)
+	{
+		return -1;
+	}
+	// the dynamic table is still searched after the const one
+	mcu_term_add_typed_command(&mt, "dyn", &dyn_schema, &dyn_cmd_cb, 0);
+	if (quiet != 0)
+	{
+		mcu_term_set_echo(&mt, MCU_TERM_ECHO_OFF);
+		mcu_term_set_batch(&mt, 1);
+	}
+
+	bench_dispatched = 0;
+	bench_echoed = 0;
+	const unsigned long allocs_before = bench_allocs;
+	const double start = bench_now();
+	size_t i = 0;
+	while (i < size)
+	{
+		int r;
+		if (mcu_term_busy(&mt) != 0)
+		{ // as the firmware does, input waits until the command is done
+			mcu_term_run(&mt);
+			continue;
+		}
+		if (chunk == 0)
+		{
+			r = mcu_term_write_char(&mt, script[i]);
+			++i;
+		}
+		else
+		{
+			const size_t n = (size - i < chunk) ? size - i : chunk;
+			r = mcu_term_write_buf(&mt, script + i, n);
+			i += (r > 0) ? r : 0;
+		}
+		if (r < 0)
+		{
+			fprintf(stderr, "bench: %s failed at %zu\n", name, i);
+			return -1;
+		}
+	}
+	while (mcu_term_run(&mt) != 0)
+	{
+	}
+	const double elapsed = bench_now() - start;
+	const unsigned long allocs = bench_allocs - allocs_before;
+	mcu_term_destroy(&mt);
+
+	fprintf(stderr, "%s\n", name);
+	fprintf(stderr, "  dispatched        %lu\n", bench_dispatched);
+	fprintf(stderr, "  echoed_bytes      %lu\n", bench_echoed);
+	fprintf(stderr, "  seconds           %.6f\n", elapsed);
+	fprintf(stderr, "  chars_per_sec     %.0f\n", size / elapsed);
+	fprintf(stderr, "  commands_per_sec  %.0f\n", lines / elapsed);
+	fprintf(stderr, "  allocs_per_cmd    %.3f\n",
+		(lines != 0) ? (double)allocs / lines : 0.0);
+	return 0;
+}
+
+// one command of the binary comparison, both as text and as arguments
+struct bench_bin_cmd
+{
+	const char* text;
+	const char* reply; // the result line the text command must print
+	uint8_t id; // index in bench_cmds
+	int32_t args[2];
+};
+
+static const struct bench_bin_cmd bench_bin_cmds[] = {
+	{ "gcd 1071 462\r", "\n21\r", 0, { 1071, 462 } },
+	{ "lcm 21 6\r", "\n42\r", 1, { 21, 6 } },
+	{ "gcd -2147483647 65536\r", "\n1\r", 0, { -2147483647, 65536 } },
+	{ "lcm 32767 8191\r", "\n268394497\r", 1, { 32767, 8191 } }
+};
+
+// sends the commands above as text lines and then as frames, reporting the
+// bytes each way per command and the binary commands per second
+static int bench_bin_run(void)
+{
+	const size_t kinds = sizeof(bench_bin_cmds) / sizeof(*bench_bin_cmds);
+	struct mcu_term mt;
+	if ((mcu_term_init(&mt, "$", &bench_text_print, &bench_text_write) !=
+		0) || (mcu_term_set_commands(&mt, bench_cmds,
+		sizeof(bench_cmds) / sizeof(*bench_cmds)) != 0))
+	{
+		return -1;
+	}
+	mcu_term_set_output(&bench_text_write);
+	unsigned long text_in = 0;
+	bench_wire_out = 0;
+	for (size_t i = 0; i < kinds; ++i)
+	{
+		const char* const text = bench_bin_cmds[i].text;
+		const size_t size = strlen(text);
+		text_in += size;
+		bench_text_out_population = 0;
+		size_t done = 0;
+		while (done < size)
+		{ // the rest of the line waits for a task the command spawned
+			const int r = mcu_term_write_buf(&mt, text + done, size - done);
+			if (r < 0)
+			{
+				break;
+			}
+			done += r;
+			while (mcu_term_run(&mt) != 0)
+			{
+			}
+		}
+		if ((done < size) ||
+			(strstr(bench_text_out, bench_bin_cmds[i].reply) == NULL))
+		{
+			fprintf(stderr, "bench: no reply to %s\n", text);
+			mcu_term_set_output(&bench_discard);
+			mcu_term_destroy(&mt);
+			return -1;
+		}
+	}
+	const unsigned long text_out = bench_wire_out;
+
+	uint8_t* const frames = malloc(BENCH_BIN_COMMANDS *
+		MCU_BIN_ENCODED_SIZE(1 + 8));
+	if (frames == NULL)
+	{
+		mcu_term_set_output(&bench_discard);
+		return -1;
+	}
+	size_t frames_size = 0;
+	for (size_t i = 0; i < BENCH_BIN_COMMANDS; ++i)
+	{
+		const struct bench_bin_cmd* const cmd = bench_bin_cmds + (i % kinds);
+		uint8_t request[1 + 8];
+		request[0] = cmd->id;
+		for (size_t j = 0; j < 8; ++j)
+		{
+			request[1 + j] = (uint8_t)((uint32_t)cmd->args[j >> 2] >>
+				((j & 3) * 8));
+		}
+		frames_size += mcu_bin_encode(frames + frames_size, request,
+			sizeof(request));
+	}
+
+	struct mcu_bin mb;
+	mcu_bin_init(&mb, &mt, &bench_bin_write);
+	mcu_term_set_output(&mcu_bin_capture);
+	bench_wire_out = 0;
+	bench_bin_replies = 0;
+	bench_bin_errors = 0;
+	const double start = bench_now();
+	for (size_t i = 0; i < frames_size; ++i)
+	{
+		mcu_bin_write_char(&mb, frames[i]);
+	}
+	const double elapsed = bench_now() - start;
+	const unsigned long bin_out = bench_wire_out;
+	free(frames);
+	mcu_term_set_output(&bench_discard);
+	mcu_term_destroy(&mt);
+
+	fprintf(stderr, "bin_vs_text\n");
+	fprintf(stderr, "  text_in_per_cmd   %.2f\n", (double)text_in / kinds);
+	fprintf(stderr, "  text_out_per_cmd  %.2f\n", (double)text_out / kinds);
+	fprintf(stderr, "  bin_in_per_cmd    %.2f\n",
+		(double)frames_size / BENCH_BIN_COMMANDS);
+	fprintf(stderr, "  bin_out_per_cmd   %.2f\n",
+		(double)bin_out / BENCH_BIN_COMMANDS);
+	fprintf(stderr, "  bin_replies       %lu\n", bench_bin_replies);
+	fprintf(stderr, "  bin_errors        %lu\n", bench_bin_errors);
+	fprintf(stderr, "  bin_cmds_per_sec  %.0f\n",
+		BENCH_BIN_COMMANDS / elapsed);
+	return ((bench_bin_replies == BENCH_BIN_COMMANDS) &&
+		(bench_bin_errors == 0)) ? 0 : -1;
+}
+
+static uint32_t bench_random(uint32_t* const state)
+{ // xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// times both gcd and lcm pairs of kernels over random operands of up to bits
+// bits and checks that they agree
+static int bench_gcd_run(const unsigned int bits)
+{
+	static int32_t a[BENCH_GCD_PAIRS];
+	static int32_t b[BENCH_GCD_PAIRS];
+	uint32_t state = 0x9E3779B9u ^ bits;
+	const uint32_t mask = (bits >= 31) ? INT32_MAX : ((1ul << bits) - 1);
+	for (size_t i = 0; i < BENCH_GCD_PAIRS; ++i)
+	{
+		a[i] = (int32_t)(bench_random(&state) & mask);
+		b[i] = (int32_t)(bench_random(&state) & mask);
+		if ((i & 1) != 0)
+		{
+			a[i] = -a[i];
+		}
+	}
+
+	unsigned long mismatches = 0;
+	unsigned long overflows = 0;
+	for (size_t i = 0; i < BENCH_GCD_PAIRS; ++i)
+	{
+		uint32_t r0, r1;
+		const int o0 = lcm(a[i], b[i], &r0);
+		const int o1 = euclid_lcm(a[i], b[i], &r1);
+		if ((gcd(a[i], b[i]) != euclid_gcd(a[i], b[i])) ||
+			(o0 != o1) || ((o0 == 0) && (r0 != r1)))
+		{
+			++mismatches;
+		}
+		overflows += (o0 != 0);
+	}
+
+	double ns[4];
+	volatile uint32_t sink = 0;
+	for (size_t k = 0; k < 4; ++k)
+	{
+		const double start = bench_now();
+		for (size_t r = 0; r < BENCH_GCD_ROUNDS; ++r)
+		{
+			for (size_t i = 0; i < BENCH_GCD_PAIRS; ++i)
+			{
+				uint32_t v = 0;
+				switch (k)
+				{
+				case 0:
+					v = gcd(a[i], b[i]);
+					break;
+				case 1:
+					v = euclid_gcd(a[i], b[i]);
+					break;
+				case 2:
+					lcm(a[i], b[i], &v);
+					break;
+				default:
+					euclid_lcm(a[i], b[i], &v);
+					break;
+				}
+				sink += v;
+			}
+		}
+		ns[k] = (bench_now() - start) * 1e9 /
+			(BENCH_GCD_ROUNDS * BENCH_GCD_PAIRS);
+	}
+	(void)sink;
+
+	fprintf(stderr, "gcd_lcm_%ubit\n", bits);
+	fprintf(stderr, "  binary_gcd_ns     %.1f\n", ns[0]);
+	fprintf(stderr, "  euclid_gcd_ns     %.1f\n", ns[1]);
+	fprintf(stderr, "  binary_lcm_ns     %.1f\n", ns[2]);
+	fprintf(stderr, "  euclid_lcm_ns     %.1f\n", ns[3]);
+	fprintf(stderr, "  lcm_overflows     %lu\n", overflows);
+	fprintf(stderr, "  mismatches        %lu\n", mismatches);
+	return (mismatches == 0) ? 0 : -1;
+}
+
+// a result line as the gcd task prints it, through mcu_term_printf_P, through
+// the direct emitters and through snprintf and a write as printf would
+static int bench_out_run(void)
+{
+	double ns[3];
+	unsigned long out[3];
+	mcu_term_set_output(&bench_text_write);
+	for (size_t k = 0; k < 3; ++k)
+	{
+		bench_wire_out = 0;
+		uint32_t state = 0x9E3779B9u;
+		const double start = bench_now();
+		for (size_t i = 0; i < BENCH_OUT_LINES; ++i)
+		{
+			const uint32_t v = bench_random(&state) >> (i & 31);
+			switch (k)
+			{
+			case 0:
+				mcu_term_printf_P("%lu\r\n", (unsigned long int)v);
+				break;
+			case 1:
+				mcu_term_out_udec(v);
+				mcu_term_out_P("\r\n");
+				break;
+			default:
+			{
+				char buf[16];
+				const int n = snprintf(buf, sizeof(buf), "%lu\r\n",
+					(unsigned long int)v);
+				bench_text_write(buf, n);
+				break;
+			}
+			}
+		}
+		ns[k] = (bench_now() - start) * 1e9 / BENCH_OUT_LINES;
+		out[k] = bench_wire_out;
+	}
+	mcu_term_set_output(&bench_discard);
+	fprintf(stderr, "out_result_line\n");
+	fprintf(stderr, "  mcu_term_printf_ns %.1f\n", ns[0]);
+	fprintf(stderr, "  mcu_term_out_ns    %.1f\n", ns[1]);
+	fprintf(stderr, "  snprintf_ns        %.1f\n", ns[2]);
+	// all three must have written the same number of bytes
+	return ((out[0] == out[2]) && (out[1] == out[2])) ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = 0;
+	char* const script = (argc > 1) ? bench_load(argv[1], &size) :
+		bench_generate(&size);
+	if (script == NULL)
+	{
+		fprintf(stderr, "bench: unable to load script\n");
+		return 1;
+	}
+	size_t lines = 0;
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (script[i] == '\r')
+		{
+			++lines;
+		}
+	}
+
+	mcu_term_set_output(&bench_discard);
+
+	fprintf(stderr, "script_bytes        %zu\n", size);
+	fprintf(stderr, "lines               %zu\n", lines);
+	// 64 byte chunks match what the rx buffer hands over in line mode
+	if ((bench_run("write_char", script, size, lines, 0, NULL, 0) != 0) ||
+		(bench_run("write_buf", script, size, lines, 64, NULL, 0) != 0) ||
+		(bench_run("write_char+write_cb", script, size, lines, 0,
+			&bench_write, 0) != 0) ||
+		(bench_run("write_buf+write_cb", script, size, lines, 64,
+			&bench_write, 0) != 0) ||
+		(bench_run("write_buf+write_cb+quiet", script, size, lines, 64,
+			&bench_write, 1) != 0) ||
+		(bench_bin_run() != 0) || (bench_gcd_run(8) != 0) ||
+		(bench_gcd_run(16) != 0) || (bench_gcd_run(24) != 0) ||
+		(bench_gcd_run(31) != 0) || (bench_out_run() != 0))
+	{
+		return 1;
+	}
+	free(script);
+	fprintf(stderr, "heap_frees          %lu\n", bench_frees);
+	return 0;
+}
@@ -171,4 +171,199 @@ static inline void cirq_place_front(struct cirq* const c,
     *p = item;
 }
 
+// CIRQ_DEFINE(name, type, width) generates struct name and name_* functions
+// for a single producer, single consumer queue of type with a compile time
+// width, so bounds fold into the code instead of being loaded from RAM.
+// Power of two widths (up to 128) use free running indices and a mask and
+// every slot is usable. Other widths (up to 255) wrap by comparison and, like
+// struct cirq, hold one item less than their width.
+
+#define CIRQ_POW2(width) ((((width) & ((width) - 1)) == 0) ? 1 : 0)
+
+// the single item functions are called from ISRs and forced inline, the
+// firmware is built with -O0 which otherwise inlines nothing
+#if defined(__GNUC__)
+#define CIRQ_INLINE inline __attribute__((always_inline))
+#else
+#define CIRQ_INLINE inline
+#endif
+
+#define CIRQ_DEFINE(name, type, width) \
+struct name \
+{ \
+    volatile type buffer[width]; \
+    volatile unsigned char head; \
+    volatile unsigned char tail; \
+}; \
+\
+_Static_assert(CIRQ_POW2(width) ? ((width) <= 128) : ((width) <= 255), \
+    #name " width out of range"); \
+\
+static CIRQ_INLINE unsigned char name##_slot(const unsigned char i) \
+{ \
+    return CIRQ_POW2(width) ? (unsigned char)(i & ((width) - 1)) : i; \
+} \
+\
+static CIRQ_INLINE unsigned char name##_advance(const unsigned char i, \
+    const unsigned char n) \
+{ \
+    if (CIRQ_POW2(width)) \
+    { \
+        return (unsigned char)(i + n); \
+    } \
+    const unsigned char run = (unsigned char)((width) - i); \
+    return (n < run) ? (unsigned char)(i + n) : (unsigned char)(n - run); \
+} \
+\
+static inline void name##_init(struct name* const c) \
+{ \
+    c->head = 0; \
+    c->tail = 0; \
+} \
+\
+static CIRQ_INLINE unsigned char name##_population(const struct name* const c) \
+{ \
+    const unsigned char head = c->head; \
+    const unsigned char tail = c->tail; \
+    if (CIRQ_POW2(width)) \
+    { \
+        return (unsigned char)(tail - head); \
+    } \
+    return (tail >= head) ? (unsigned char)(tail - head) : \
+        (unsigned char)((width) - head + tail); \
+} \
+\
+static CIRQ_INLINE char name##_empty(const struct name* const c) \
+{ \
+    return (c->head == c->tail) ? 1 : 0; \
+} \
+\
+static CIRQ_INLINE unsigned char name##_space(const struct name* const c) \
+{ \
+    return (unsigned char)((CIRQ_POW2(width) ? (width) : (width) - 1) - \
+        name##_population(c)); \
+} \
+\
+/* producer side, increments tail */ \
+static CIRQ_INLINE void name##_push_back(struct name* const c, \
+    const type item) \
+{ \
+    const unsigned char tail = c->tail; \
+    c->buffer[name##_slot(tail)] = item; \
+    c->tail = name##_advance(tail, 1); \
+} \
+\
+/* consumer side, increments head */ \
+static CIRQ_INLINE type name##_pop_front(struct name* const c) \
+{ \
+    const unsigned char head = c->head; \
+    const type item = c->buffer[name##_slot(head)]; \
+    c->head = name##_advance(head, 1); \
+    return item; \
+} \
+\
+/* consumer side */ \
+static inline type name##_peek_front(const struct name* const c, \
+    const unsigned char index) \
+{ \
+    return c->buffer[name##_slot(name##_advance(c->head, index))]; \
+} \
+\
+/* consumer side, discards everything currently queued */ \
+static inline void name##_flush(struct name* const c) \
+{ \
+    c->head = c->tail; \
+} \
+\
+/* the bulk operations copy in at most two contiguous runs, up to the end of \
+ * the buffer and then from its start, and load and store head/tail once */ \
+\
+/* producer side, pushes up to size items and publishes tail once */ \
+static inline size_t name##_push_n(struct name* const c, const type* data, \
+    size_t size) \
+{ \
+    const unsigned char space = name##_space(c); \
+    if (size > space) \
+    { \
+        size = space; \
+    } \
+    const unsigned char tail = c->tail; \
+    const unsigned char slot = name##_slot(tail); \
+    const size_t run = (size_t)((width) - slot); \
+    volatile type* p = c->buffer + slot; \
+    const type* limit = data + ((size < run) ? size : run); \
+    while (data != limit) \
+    { \
+        *p = *data; \
+        ++p; \
+        ++data; \
+    } \
+    if (size > run) \
+    { \
+        p = c->buffer; \
+        limit += size - run; \
+        while (data != limit) \
+        { \
+            *p = *data; \
+            ++p; \
+            ++data; \
+        } \
+    } \
+    c->tail = name##_advance(tail, (unsigned char)size); \
+    return size; \
+} \
+\
+/* consumer side, copies up to size items from index positions past head */ \
+static inline size_t name##_peek_n(const struct name* const c, \
+    const size_t index, type* buffer, size_t size) \
+{ \
+    const unsigned char population = name##_population(c); \
+    if (index >= population) \
+    { \
+        return 0; \
+    } \
+    if (size > population - index) \
+    { \
+        size = population - index; \
+    } \
+    const unsigned char slot = \
+        name##_slot(name##_advance(c->head, (unsigned char)index)); \
+    const size_t run = (size_t)((width) - slot); \
+    volatile const type* p = c->buffer + slot; \
+    type* limit = buffer + ((size < run) ? size : run); \
+    while (buffer != limit) \
+    { \
+        *buffer = *p; \
+        ++p; \
+        ++buffer; \
+    } \
+    if (size > run) \
+    { \
+        p = c->buffer; \
+        limit += size - run; \
+        while (buffer != limit) \
+        { \
+            *buffer = *p; \
+            ++p; \
+            ++buffer; \
+        } \
+    } \
+    return size; \
+} \
+\
+/* consumer side, discards n items, which must be queued, after a peek_n */ \
+static inline void name##_discard_n(struct name* const c, const size_t n) \
+{ \
+    c->head = name##_advance(c->head, (unsigned char)n); \
+} \
+\
+/* consumer side, pops up to size items and publishes head once */ \
+static inline size_t name##_pop_n(struct name* const c, type* const buffer, \
+    const size_t size) \
+{ \
+    const size_t n = name##_peek_n(c, 0, buffer, size); \
+    name##_discard_n(c, n); \
+    return n; \
+}
+
 #endif
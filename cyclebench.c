@@ -0,0 +1,329 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// simavr harness for 'make cyclebench'. Runs a CYCLEBENCH firmware build,
+// types a command script into UART0 one byte at a time and timestamps the
+// probe writes from cyclebench.h. Cycles spent in a nested ISR, or in the
+// binary against Euclid kernel comparison, are not charged to the path it is
+// nested in. The report is one tab separated line per path.
+
+#include "cyclebench.h"
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "avr_uart.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CYCLEBENCH_MAX_PATH 0x80
+#define CYCLEBENCH_STACK_DEPTH 16
+#define CYCLEBENCH_CYCLE_LIMIT 4000000000ull
+
+struct cyclebench_stat
+{
+	unsigned long calls;
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+};
+
+struct cyclebench_frame
+{
+	uint8_t path;
+	avr_cycle_count_t start;
+	avr_cycle_count_t nested_apart;
+};
+
+static struct cyclebench_stat stats[CYCLEBENCH_MAX_PATH];
+static struct cyclebench_frame stack[CYCLEBENCH_STACK_DEPTH];
+static size_t stack_depth = 0;
+static int waiting_for_line = 0;
+static unsigned long output_bytes = 0;
+
+static const char default_script[] =
+	"gcd 1071 462\r"
+	"gcd 2147483646 1073741823\r"
+	"gcd -48 18\r"
+	"lcm 21 6\r"
+	"lcm 65535 65521\r"
+	"lcm 2147483647 2\r"
+	"lcm 4294967296 3 5 7 11 13\r"
+	"gcd 0x123456789abcdef0123456789 0xfedcba9876543210fedcba98\r"
+	"lcm 2 3 5 7 11 13 17 19 23 29 31 37 41 43 47 53 59 61 67 71 73 79 83 89 "
+	"97 101 103 107 109 113\r"
+	"unknown a b c d e f g h\r"
+	"\r";
+
+#define CYCLEBENCH_NAME(id, name) [id] = #name,
+static const char* const path_names[CYCLEBENCH_MAX_PATH] = {
+	CYCLEBENCH_PATHS(CYCLEBENCH_NAME)
+};
+#undef CYCLEBENCH_NAME
+
+// ISRs, and the kernel comparison the firmware only runs under CYCLEBENCH,
+// are not charged to the path they are nested in
+static int path_is_apart(const uint8_t path)
+{
+	return (path == CYCLEBENCH_uart_rx_isr) ||
+		(path == CYCLEBENCH_uart_udre_isr) ||
+		((path >= CYCLEBENCH_binary_gcd) && (path <= CYCLEBENCH_euclid_lcm));
+}
+
+static void probe_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v,
+	void* param)
+{
+	(void)addr;
+	(void)param;
+	const uint8_t path = v & ~CYCLEBENCH_EXIT_FLAG;
+	if (path == 0)
+	{
+		return;
+	}
+	if ((v & CYCLEBENCH_EXIT_FLAG) == 0)
+	{
+		if (stack_depth < CYCLEBENCH_STACK_DEPTH)
+		{
+			stack[stack_depth].path = path;
+			stack[stack_depth].start = avr->cycle;
+			stack[stack_depth].nested_apart = 0;
+			++stack_depth;
+		}
+		return;
+	}
+	// unwind to the matching entry, anything above it never exited
+	while ((stack_depth != 0) && (stack[stack_depth - 1].path != path))
+	{
+		--stack_depth;
+	}
+	if (stack_depth == 0)
+	{
+		return;
+	}
+	--stack_depth;
+	const struct cyclebench_frame* const f = stack + stack_depth;
+	const avr_cycle_count_t elapsed = avr->cycle - f->start;
+	const uint64_t cycles = elapsed - f->nested_apart;
+	struct cyclebench_stat* const s = stats + path;
+	if ((s->calls == 0) || (cycles < s->min))
+	{
+		s->min = cycles;
+	}
+	if (cycles > s->max)
+	{
+		s->max = cycles;
+	}
+	s->total += cycles;
+	++s->calls;
+	if (path_is_apart(path))
+	{ // ISRs nested in this path have been taken off the ones below already
+		for (size_t i = 0; i < stack_depth; ++i)
+		{
+			stack[i].nested_apart += cycles;
+		}
+	}
+	if ((path == CYCLEBENCH_mcu_term_write_char) ||
+		(path == CYCLEBENCH_mcu_term_line))
+	{
+		waiting_for_line = 0;
+	}
+}
+
+static void uart_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+	(void)irq;
+	(void)value;
+	(void)param;
+	++output_bytes;
+}
+
+static char* load_script(const char* const path, size_t* const size)
+{
+	FILE* const f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* const script = malloc((len > 0) ? len : 1);
+	if ((script == NULL) || (fread(script, 1, len, f) != (size_t)len))
+	{
+		free(script);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	for (long i = 0; i < len; ++i)
+	{
+		if (script[i] == '\n')
+		{
+			script[i] = '\r';
+		}
+	}
+	*size = len;
+	return script;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: cyclebench -m mcu -p probe_addr [-f freq] "
+		"[-o report] firmware.elf [script]\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* mcu = NULL;
+	const char* report = NULL;
+	unsigned long freq = 16000000;
+	avr_io_addr_t probe = 0;
+	int i = 1;
+	for (; (i + 1 < argc) && (argv[i][0] == '-'); i += 2)
+	{
+		switch (argv[i][1])
+		{
+		case 'm':
+			mcu = argv[i + 1];
+			break;
+		case 'f':
+			freq = strtoul(argv[i + 1], 0, 0);
+			break;
+		case 'p':
+			probe = (avr_io_addr_t)strtoul(argv[i + 1], 0, 0);
+			break;
+		case 'o':
+			report = argv[i + 1];
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if ((mcu == NULL) || (probe == 0) || (i >= argc))
+	{
+		usage();
+		return 1;
+	}
+	const char* const firmware_path = argv[i];
+	size_t script_size = sizeof(default_script) - 1;
+	const char* script = default_script;
+	if (i + 1 < argc)
+	{
+		script = load_script(argv[i + 1], &script_size);
+		if (script == NULL)
+		{
+			fprintf(stderr, "cyclebench: unable to load %s\n", argv[i + 1]);
+			return 1;
+		}
+	}
+
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(firmware_path, &firmware) != 0)
+	{
+		fprintf(stderr, "cyclebench: unable to load %s\n", firmware_path);
+		return 1;
+	}
+	avr_t* const avr = avr_make_mcu_by_name(mcu);
+	if (avr == NULL)
+	{
+		fprintf(stderr, "cyclebench: simavr does not support %s\n", mcu);
+		return 1;
+	}
+	avr_init(avr);
+	avr->frequency = freq;
+	avr_load_firmware(avr, &firmware);
+	avr_register_io_write(avr, probe, &probe_write, NULL);
+
+	uint32_t flags = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	avr_irq_t* const rx = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+		UART_IRQ_INPUT);
+	avr_irq_t* const tx = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+		UART_IRQ_OUTPUT);
+	avr_irq_register_notify(tx, &uart_output, NULL);
+
+	size_t fed = 0;
+	while (1)
+	{
+		const int state = avr_run(avr);
+		if ((state == cpu_Done) || (state == cpu_Crashed))
+		{
+			fprintf(stderr, "cyclebench: firmware stopped at cycle %llu\n",
+				(unsigned long long)avr->cycle);
+			return 1;
+		}
+		if (avr->cycle > CYCLEBENCH_CYCLE_LIMIT)
+		{
+			fprintf(stderr, "cyclebench: cycle limit reached\n");
+			return 1;
+		}
+		if ((state != cpu_Sleeping) || (waiting_for_line != 0))
+		{
+			continue;
+		}
+		if (fed == script_size)
+		{
+			break;
+		}
+		// type the next character once the previous one has been handled
+		avr_raise_irq(rx, (uint8_t)script[fed]);
+		++fed;
+		waiting_for_line = 1;
+	}
+
+	FILE* const out = (report != NULL) ? fopen(report, "w") : stdout;
+	if (out == NULL)
+	{
+		fprintf(stderr, "cyclebench: unable to write %s\n", report);
+		return 1;
+	}
+	fprintf(out, "mcu\tpath\tcalls\tmin\tmax\tmean\n");
+	for (size_t p = 0; p < CYCLEBENCH_MAX_PATH; ++p)
+	{
+		const struct cyclebench_stat* const s = stats + p;
+		if (path_names[p] == NULL)
+		{
+			continue;
+		}
+		fprintf(out, "%s\t%s\t%lu\t%llu\t%llu\t%llu\n", mcu, path_names[p],
+			s->calls, (unsigned long long)s->min, (unsigned long long)s->max,
+			(unsigned long long)((s->calls != 0) ? s->total / s->calls : 0));
+	}
+	fprintf(out, "%s\ttotal_cycles\t1\t%llu\t%llu\t%llu\n", mcu,
+		(unsigned long long)avr->cycle, (unsigned long long)avr->cycle,
+		(unsigned long long)avr->cycle);
+	fprintf(out, "%s\tuart0_output_bytes\t1\t%lu\t%lu\t%lu\n", mcu,
+		output_bytes, output_bytes, output_bytes);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// cycle counting probes for 'make cyclebench'. When the firmware is built with
+// CYCLEBENCH defined each probe is a single write of the path id to GPIOR0,
+// the simulator harness (cyclebench.c) timestamps those writes. Otherwise the
+// probes compile to nothing.
+
+#ifndef CYCLEBENCH_H
+#define CYCLEBENCH_H
+
+// X(id, name), ids must fit in 7 bits, bit 7 marks the exit of a path
+#define CYCLEBENCH_PATHS(X) \
+	X(1, uart_rx_isr) \
+	X(2, uart_udre_isr) \
+	X(3, uart_rx) \
+	X(4, uart_tx) \
+	X(5, mcu_term_write_char) \
+	X(6, mcu_term_line) \
+	X(7, gcd_token_cb) \
+	X(8, gcd_end_cb) \
+	X(9, gcd_fold) \
+	X(10, gcd_print) \
+	X(11, binary_gcd) \
+	X(12, euclid_gcd) \
+	X(13, binary_lcm) \
+	X(14, euclid_lcm)
+
+#define CYCLEBENCH_EXIT_FLAG 0x80
+
+#define CYCLEBENCH_ENUM(id, name) CYCLEBENCH_##name = (id),
+enum cyclebench_path
+{
+	CYCLEBENCH_PATHS(CYCLEBENCH_ENUM)
+};
+#undef CYCLEBENCH_ENUM
+
+#if defined(CYCLEBENCH) && defined(__AVR__)
+
+#include <avr/io.h>
+
+#define CYCLEBENCH_ENTER(path) (GPIOR0 = (path))
+#define CYCLEBENCH_EXIT(path) (GPIOR0 = (path) | CYCLEBENCH_EXIT_FLAG)
+
+#else
+
+#define CYCLEBENCH_ENTER(path) ((void)(path))
+#define CYCLEBENCH_EXIT(path) ((void)(path))
+
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+ */
+
+#include "mcu_bin.h"
+
+#include <string.h>
+
+#if defined(__AVR__)
+#include <util/crc16.h>
+#endif
+
+#define MCU_BIN_CRC_INIT 0xFFFF
+// longest command name copied out of the table
+#define MCU_BIN_NAME_SIZE 16
+// "-2147483648"
+#define MCU_BIN_ARG_TEXT_SIZE 12
+
+// the instance whose command is running, mcu_bin_capture appends to its reply
+static struct mcu_bin* mcu_bin_current = 0;
+
+static inline void mcu_bin_read_P(void* const dst, const void* const src,
+                                  const size_t size)
+{
+#if defined(__AVR__)
+    memcpy_P(dst, src, size);
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+static inline void mcu_bin_strncpy_P(char* const dst, const char* const src_P,
+                                     const size_t size)
+{
+#if defined(__AVR__)
+    strncpy_P(dst, src_P, size);
+#else
+    strncpy(dst, src_P, size);
+#endif
+}
+
+uint16_t mcu_bin_crc16(uint16_t crc, const uint8_t* data, size_t size)
+{
+    while (size != 0)
+    {
+#if defined(__AVR__)
+        crc = _crc_xmodem_update(crc, *data);
+#else
+        crc ^= (uint16_t) * data << 8;
+        unsigned char i = 0;
+        while (i < 8)
+        {
+            crc = ((crc & 0x8000) != 0) ? (crc << 1) ^ 0x1021 : crc << 1;
+            ++i;
+        }
+#endif
+        ++data;
+        --size;
+    }
+    return crc;
+}
+
+// appends the CRC of src and COBS encodes the lot into dst, terminator
+// included. dst must hold MCU_BIN_ENCODED_SIZE(size) bytes, returns the
+// number used.
+size_t mcu_bin_encode(uint8_t * const dst, const uint8_t * const src,
+                      const size_t size)
+{
+    const uint16_t crc = mcu_bin_crc16(MCU_BIN_CRC_INIT, src, size);
+    size_t code_i = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    size_t i = 0;
+    while (i < size + 2)
+    {
+        const uint8_t b = (i < size) ? src[i] :
+                ((i == size) ? (uint8_t) crc : (uint8_t) (crc >> 8));
+        if (b == 0)
+        {
+            dst[code_i] = code;
+            code_i = out++;
+            code = 1;
+        }
+        else
+        {
+            dst[out++] = b;
+            if (++code == 0xFF)
+            { // longest block, no zero implied after it
+                dst[code_i] = code;
+                code_i = out++;
+                code = 1;
+            }
+        }
+        ++i;
+    }
+    dst[code_i] = code;
+    dst[out++] = 0;
+    return out;
+}
+
+// COBS decodes size bytes of src, terminator excluded, into dst (which may be
+// src) and checks and strips the CRC. Returns the length of what is left, -1
+// if the frame is malformed or the CRC does not match.
+int mcu_bin_decode(uint8_t * const dst, const uint8_t * const src,
+                   const size_t size)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size)
+    {
+        const uint8_t code = src[in++];
+        if ((code == 0) || (in + code - 1 > size))
+        {
+            return -1;
+        }
+        uint8_t i = 1;
+        while (i < code)
+        {
+            dst[out++] = src[in++];
+            ++i;
+        }
+        if ((code != 0xFF) && (in < size))
+        {
+            dst[out++] = 0;
+        }
+    }
+    if (out < 2)
+    {
+        return -1;
+    }
+    out -= 2;
+    const uint16_t crc = mcu_bin_crc16(MCU_BIN_CRC_INIT, dst, out);
+    if ((dst[out] != (uint8_t) crc) || (dst[out + 1] != (uint8_t) (crc >> 8)))
+    {
+        return -1;
+    }
+    return out;
+}
+
+int mcu_bin_capture(const char* str, size_t size)
+{
+    struct mcu_bin * const mb = mcu_bin_current;
+    if (mb == 0)
+    { // nothing is running, stray output would corrupt the framing
+        return -1;
+    }
+    const size_t space = MCU_BIN_REPLY_SIZE - mb->reply_population;
+    if (size > space)
+    {
+        mb->reply[1] = MCU_BIN_TRUNCATED;
+        size = space;
+    }
+    memcpy(mb->reply + 2 + mb->reply_population, str, size);
+    mb->reply_population += size;
+    return 0;
+}
+
+// runs the command. A command with a schema is given the values as they are,
+// any other takes text, so its arguments are written out as the terminal
+// would have received them.
+static void mcu_bin_dispatch(struct mcu_bin * const mb, const uint8_t* frame,
+                             const size_t size, char* const text)
+{
+    const uint8_t id = frame[0];
+    mb->reply[0] = id;
+    mb->reply[1] = MCU_BIN_OK;
+    const size_t argc = 1 + ((size - 1) >> 2);
+    if ((((size - 1) & 3) != 0) || (argc > 1 + MCU_BIN_MAX_ARGS))
+    {
+        mb->reply[1] = MCU_BIN_BAD_ARGS;
+        return;
+    }
+    if (id >= mb->mt->const_cmds_size)
+    {
+        mb->reply[1] = MCU_BIN_BAD_ID;
+        return;
+    }
+    struct mcu_term_const_cmd cmd;
+    mcu_bin_read_P(&cmd, mb->mt->const_cmds + id, sizeof (cmd));
+    char* argv[1 + MCU_BIN_MAX_ARGS];
+    argv[0] = text;
+    mcu_bin_strncpy_P(text, cmd.cmd, MCU_BIN_NAME_SIZE - 1);
+    text[MCU_BIN_NAME_SIZE - 1] = 0;
+    int32_t values[MCU_BIN_MAX_ARGS];
+    size_t i = 0;
+    while (i < argc - 1)
+    {
+        ++frame;
+        values[i] = (int32_t) ((uint32_t) frame[0] |
+                               ((uint32_t) frame[1] << 8) |
+                               ((uint32_t) frame[2] << 16) |
+                               ((uint32_t) frame[3] << 24));
+        frame += 3;
+        ++i;
+    }
+    const unsigned char typed = ((cmd.schema != 0) && (cmd.stream == 0)) ?
+            1 : 0;
+    if (typed == 0)
+    {
+        char* arg_text = text + MCU_BIN_NAME_SIZE;
+        i = 1;
+        while (i < argc)
+        {
+            argv[i] = arg_text;
+            arg_text += mcu_term_format_dec(arg_text, values[i - 1]);
+            ++i;
+        }
+    }
+    mcu_bin_current = mb;
+    const int r = (typed != 0) ?
+            mcu_term_call_values(&cmd, argc, argv, values) :
+            mcu_term_call(&cmd, argc, argv);
+    if (r != 0)
+    {
+        mb->reply[1] = MCU_BIN_BAD_ARGS;
+    }
+    mcu_bin_current = 0;
+}
+
+// feeds one byte of encoded input, a request is run and answered when its
+// terminator arrives. Returns 1 once the exit request has been answered, 0
+// otherwise.
+int mcu_bin_write_char(struct mcu_bin * const mb, const uint8_t c)
+{
+    if (c != 0)
+    {
+        if (mb->population < sizeof (mb->frame))
+        {
+            mb->frame[mb->population] = c;
+            ++mb->population;
+        }
+        else
+        { // too long to be a request, answered when it ends
+            mb->overflow = 1;
+        }
+        return 0;
+    }
+    if ((mb->population == 0) && (mb->overflow == 0))
+    { // back to back terminators can be used to resynchronise
+        return 0;
+    }
+    // the argument text of a command without a schema is built here, then the
+    // reply is encoded over it
+    union
+    {
+        char text[MCU_BIN_NAME_SIZE + (MCU_BIN_ARG_TEXT_SIZE *
+                                       MCU_BIN_MAX_ARGS)];
+        uint8_t encoded[MCU_BIN_ENCODED_SIZE(sizeof (mb->reply))];
+    } scratch;
+    mb->reply_population = 0;
+    const int size = (mb->overflow != 0) ? -1 :
+            mcu_bin_decode(mb->frame, mb->frame, mb->population);
+    mb->population = 0;
+    mb->overflow = 0;
+    int r = 0;
+    if (size <= 0)
+    {
+        mb->reply[0] = 0;
+        mb->reply[1] = MCU_BIN_BAD_FRAME;
+    }
+    else if ((mb->frame[0] == MCU_BIN_EXIT_ID) && (size == 1))
+    {
+        mb->reply[0] = MCU_BIN_EXIT_ID;
+        mb->reply[1] = MCU_BIN_OK;
+        r = 1;
+    }
+    else
+    {
+        mcu_bin_dispatch(mb, mb->frame, size, scratch.text);
+    }
+    const size_t n = mcu_bin_encode(scratch.encoded, mb->reply,
+                                    2 + mb->reply_population);
+    mb->write((const char*) scratch.encoded, n);
+    return r;
+}
+
+void mcu_bin_init(struct mcu_bin * const mb, const struct mcu_term * const mt,
+                  int(* const write) (const char*, size_t))
+{
+    mb->population = 0;
+    mb->overflow = 0;
+    mb->reply_population = 0;
+    mb->mt = mt;
+    mb->write = write;
+}
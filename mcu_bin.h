@@ -0,0 +1,85 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+ */
+
+// binary framed protocol on the same link as an mcu_term. A request is a
+// command id, the index of the command in the terminal's const table, followed
+// by up to MCU_BIN_MAX_ARGS signed 32 bit arguments, little endian. A reply is
+// the command id, an mcu_bin_status and whatever text the command printed.
+// Both are followed by a CRC-16/CCITT-FALSE of everything before it, low byte
+// first, COBS encoded and terminated by a 0x00 byte. A command with a schema
+// is given the arguments as values, any other as decimal text.
+
+#ifndef MCU_BIN_H
+#define	MCU_BIN_H
+
+#include "mcu_term.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// no more than MCU_TERM_TYPED_ARGS, so a schema can take them all as values
+#define MCU_BIN_MAX_ARGS 4
+// text a command may print before its reply is truncated
+#define MCU_BIN_REPLY_SIZE 64
+// request id that leaves binary mode
+#define MCU_BIN_EXIT_ID 0xFF
+// bytes needed to encode size bytes, CRC, COBS overhead and terminator included
+#define MCU_BIN_ENCODED_SIZE(size) ((size) + 2 + (((size) + 2) / 254) + 2)
+
+enum mcu_bin_status
+{
+    MCU_BIN_OK,
+    MCU_BIN_BAD_FRAME, // COBS or CRC error, the id in the reply is meaningless
+    MCU_BIN_BAD_ID, // no command at that index
+    // length is not a whole number of arguments, or the command's schema
+    // refused them
+    MCU_BIN_BAD_ARGS,
+    MCU_BIN_TRUNCATED // the command printed more than MCU_BIN_REPLY_SIZE
+};
+
+struct mcu_bin
+{
+    // encoded request, without the terminator
+    uint8_t frame[MCU_BIN_ENCODED_SIZE(1 + (4 * MCU_BIN_MAX_ARGS)) - 1];
+    size_t population;
+    unsigned char overflow;
+    // id, status and captured text of the reply being built
+    uint8_t reply[2 + MCU_BIN_REPLY_SIZE];
+    size_t reply_population;
+    const struct mcu_term* mt;
+    int(*write)(const char*, size_t);
+};
+
+uint16_t mcu_bin_crc16(uint16_t crc, const uint8_t* data, size_t size);
+size_t mcu_bin_encode(uint8_t * const dst, const uint8_t * const src,
+                      const size_t size);
+int mcu_bin_decode(uint8_t * const dst, const uint8_t * const src,
+                   const size_t size);
+// output of the command being dispatched is appended to its reply, route the
+// stream the commands print to through this while in binary mode
+int mcu_bin_capture(const char* str, size_t size);
+int mcu_bin_write_char(struct mcu_bin * const mb, const uint8_t c);
+void mcu_bin_init(struct mcu_bin * const mb, const struct mcu_term * const mt,
+                  int(* const write) (const char*, size_t));
+
+#endif
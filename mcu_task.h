@@ -0,0 +1,63 @@
+/*The MIT License (MIT)
+
+Copyright (c) 2015 Julian Ingram
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+ */
+
+// protothread style tasks for commands that take a while. A task function
+// picks up where it last yielded, so its locals don't survive a yield, keep
+// them in the state it is passed. E.g.
+//
+// struct count { struct mcu_task task; int i; };
+//
+// static int count_task(void* arg)
+// {
+//     struct count * const c = arg;
+//     MCU_TASK_BEGIN(&c->task);
+//     for (c->i = 0; c->i < 100; ++c->i)
+//     {
+//         printf("%d\r\n", c->i);
+//         MCU_TASK_YIELD(&c->task);
+//     }
+//     MCU_TASK_END(&c->task);
+// }
+//
+// switch statements can't span a yield.
+
+#ifndef MCU_TASK_H
+#define	MCU_TASK_H
+
+#define MCU_TASK_DONE 0
+#define MCU_TASK_BUSY 1
+
+struct mcu_task
+{
+    unsigned short lc; // where to resume, 0 is the start
+};
+
+#define MCU_TASK_INIT(t) ((t)->lc = 0)
+#define MCU_TASK_BEGIN(t) switch ((t)->lc) { case 0:
+#define MCU_TASK_YIELD(t) \
+    do { (t)->lc = __LINE__; return MCU_TASK_BUSY; case __LINE__:; } while (0)
+#define MCU_TASK_END(t) } (t)->lc = 0; return MCU_TASK_DONE
+// finishes the task early, from anywhere between BEGIN and END
+#define MCU_TASK_EXIT(t) do { (t)->lc = 0; return MCU_TASK_DONE; } while (0)
+
+#endif
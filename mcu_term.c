@@ -22,8 +22,23 @@ THE SOFTWARE.
  */
 
 #include "mcu_term.h"
+#include "mcu_task.h"
 
+#include <stdarg.h>
 #include <string.h>
+#if defined(MCU_TERM_OUT_PRINTF)
+#include <stdio.h>
+#endif
+
+// the terminal whose command is being dispatched, for mcu_term_spawn
+static struct mcu_term* mcu_term_dispatching = 0;
+
+// mt->line_flags
+#define MCU_TERM_LINE_NAMED 0x01 // the command name is followed by a space
+#define MCU_TERM_LINE_LONG 0x02 // characters were lost, the line is refused
+#define MCU_TERM_LINE_ENDING 0x04 // a stream ends when its task finishes
+// where mcu_term_out and friends write
+static int(*mcu_term_output) (const char*, size_t) = 0;
 
 static inline void* mcu_term_allocate(const size_t size)
 {
@@ -40,10 +55,47 @@ static inline void mcu_term_deallocate(void* const ptr)
     free(ptr);
 }
 
-int mcu_term_print_string(const struct mcu_term * const mt, const char* str)
+// const command tables live in flash on AVR
+static inline void mcu_term_read_P(void* const dst, const void* const src,
+                                   const size_t size)
+{
+#if defined(__AVR__)
+    memcpy_P(dst, src, size);
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+static inline char mcu_term_read_byte_P(const char* const str_P)
 {
+#if defined(__AVR__)
+    return pgm_read_byte(str_P);
+#else
+    return *str_P;
+#endif
+}
+
+static inline int mcu_term_strcmp_P(const char* const str,
+                                    const char* const str_P)
+{
+#if defined(__AVR__)
+    return strcmp_P(str, str_P);
+#else
+    return strcmp(str, str_P);
+#endif
+}
+
+// writes size characters, in one call if there is a write callback, returns
+// the number written
+static size_t mcu_term_emit(const struct mcu_term * const mt,
+                            const char* const str, const size_t size)
+{
+    if (mt->write != 0)
+    {
+        return (mt->write(str, size) == 0) ? size : 0;
+    }
     size_t i = 0;
-    while (str[i] != 0)
+    while (i < size)
     {
         if (mt->print(str[i]) != 0)
         {
@@ -54,9 +106,354 @@ int mcu_term_print_string(const struct mcu_term * const mt, const char* str)
     return i;
 }
 
-int mcu_term_add_command(struct mcu_term * const mt, const char* const cmd,
-                         void(* const cb) (void*, size_t, char**),
-                         void* const cb_arg)
+int mcu_term_print_string(const struct mcu_term * const mt, const char* str)
+{
+    return mcu_term_emit(mt, str, strlen(str));
+}
+
+// flash strings go out through a small stack buffer
+int mcu_term_print_string_P(const struct mcu_term * const mt,
+                            const char* str_P)
+{
+    char chunk[16];
+    size_t printed = 0;
+    while (1)
+    {
+        size_t n = 0;
+        while ((n < sizeof (chunk)) &&
+               ((chunk[n] = mcu_term_read_byte_P(str_P + n)) != 0))
+        {
+            ++n;
+        }
+        const size_t emitted = mcu_term_emit(mt, chunk, n);
+        printed += emitted;
+        if ((emitted != n) || (n != sizeof (chunk)))
+        {
+            break;
+        }
+        str_P += n;
+    }
+    return printed;
+}
+
+void mcu_term_set_output(int(* const write) (const char*, size_t))
+{
+    mcu_term_output = write;
+}
+
+static int mcu_term_out_write(const char* const str, const size_t size)
+{
+    if (mcu_term_output == 0)
+    {
+        return -1;
+    }
+    return mcu_term_output(str, size);
+}
+
+// digits of v, most significant first
+static size_t mcu_term_render_udec(char* const buf, uint32_t v)
+{
+#if defined(__AVR__)
+    // the AVR has no divider, so the powers of 10 are subtracted out instead,
+    // at most 9 times each
+    static const uint32_t powers[] MCU_TERM_PROGMEM = {
+        1000000000ul, 100000000ul, 10000000ul, 1000000ul, 100000ul, 10000ul,
+        1000ul, 100ul, 10ul
+    };
+    const size_t count = sizeof (powers) / sizeof (*powers);
+    size_t i = 0;
+    uint32_t power;
+    // past the leading zeros
+    do
+    {
+        mcu_term_read_P(&power, powers + i, sizeof (power));
+    }
+    while ((v < power) && (++i < count));
+    size_t n = 0;
+    while (i < count)
+    {
+        mcu_term_read_P(&power, powers + i, sizeof (power));
+        char c = '0';
+        while (v >= power)
+        {
+            v -= power;
+            ++c;
+        }
+        buf[n++] = c;
+        ++i;
+    }
+    buf[n++] = '0' + v;
+    return n;
+#else
+    // a host divides by a constant with a multiply
+    char digits[10];
+    size_t i = sizeof (digits);
+    do
+    {
+        digits[--i] = '0' + (v % 10);
+        v /= 10;
+    }
+    while (v != 0);
+    const size_t n = sizeof (digits) - i;
+    memcpy(buf, digits + i, n);
+    return n;
+#endif
+}
+
+static size_t mcu_term_render_hex(char* const buf, const uint32_t v)
+{
+    size_t n = 0;
+    unsigned char shift = 32;
+    do
+    {
+        shift -= 4;
+        const unsigned char nibble = (v >> shift) & 0xf;
+        if ((nibble != 0) || (n != 0) || (shift == 0))
+        {
+            buf[n++] = (nibble < 10) ? ('0' + nibble) : ('a' - 10 + nibble);
+        }
+    }
+    while (shift != 0);
+    return n;
+}
+
+int mcu_term_out(const char* const str)
+{
+    return mcu_term_out_write(str, strlen(str));
+}
+
+int mcu_term_out_P(const char* str_P)
+{
+    char chunk[MCU_TERM_OUT_SIZE];
+    while (1)
+    {
+        size_t n = 0;
+        while ((n < sizeof (chunk)) &&
+               ((chunk[n] = mcu_term_read_byte_P(str_P + n)) != 0))
+        {
+            ++n;
+        }
+        if ((n != 0) && (mcu_term_out_write(chunk, n) != 0))
+        {
+            return -1;
+        }
+        if (n != sizeof (chunk))
+        {
+            return 0;
+        }
+        str_P += n;
+    }
+}
+
+int mcu_term_out_char(const char c)
+{
+    return mcu_term_out_write(&c, 1);
+}
+
+static size_t mcu_term_render_dec(char* const buf, const int32_t v)
+{
+    buf[0] = '-';
+    return (v < 0) ? (1 + mcu_term_render_udec(buf + 1, -(uint32_t) v)) :
+            mcu_term_render_udec(buf, v);
+}
+
+size_t mcu_term_format_dec(char* const buf, const int32_t v)
+{
+    const size_t n = mcu_term_render_dec(buf, v);
+    buf[n] = 0;
+    return n + 1;
+}
+
+int mcu_term_out_dec(const int32_t v)
+{
+    char buf[11];
+    return mcu_term_out_write(buf, mcu_term_render_dec(buf, v));
+}
+
+int mcu_term_out_udec(const uint32_t v)
+{
+    char buf[10];
+    return mcu_term_out_write(buf, mcu_term_render_udec(buf, v));
+}
+
+int mcu_term_out_hex(const uint32_t v)
+{
+    char buf[8];
+    return mcu_term_out_write(buf, mcu_term_render_hex(buf, v));
+}
+
+#if defined(MCU_TERM_OUT_PRINTF)
+
+int mcu_term_printf_P(const char* const fmt_P, ...)
+{
+    va_list args;
+    va_start(args, fmt_P);
+#if defined(__AVR__)
+    const int r = vfprintf_P(stdout, fmt_P, args);
+#else
+    const int r = vprintf(fmt_P, args);
+#endif
+    va_end(args);
+    return (r < 0) ? -1 : 0;
+}
+
+#else
+
+// the rendered text so far, written out whenever it fills up
+struct mcu_term_out_buf
+{
+    char arr[MCU_TERM_OUT_SIZE];
+    size_t population;
+    int r;
+};
+
+static void mcu_term_out_put_char(struct mcu_term_out_buf * const ob,
+                                  const char c)
+{
+    ob->arr[ob->population++] = c;
+    if (ob->population == sizeof (ob->arr))
+    {
+        ob->r |= mcu_term_out_write(ob->arr, ob->population);
+        ob->population = 0;
+    }
+}
+
+static void mcu_term_out_put(struct mcu_term_out_buf * const ob,
+                             const char* str, size_t size)
+{
+    while (size != 0)
+    {
+        size_t n = sizeof (ob->arr) - ob->population;
+        if (n > size)
+        {
+            n = size;
+        }
+        memcpy(ob->arr + ob->population, str, n);
+        ob->population += n;
+        str += n;
+        size -= n;
+        if (ob->population == sizeof (ob->arr))
+        {
+            ob->r |= mcu_term_out_write(ob->arr, ob->population);
+            ob->population = 0;
+        }
+    }
+}
+
+int mcu_term_printf_P(const char* fmt_P, ...)
+{
+    struct mcu_term_out_buf ob;
+    ob.population = 0;
+    ob.r = 0;
+    va_list args;
+    va_start(args, fmt_P);
+    char c;
+    while ((c = mcu_term_read_byte_P(fmt_P++)) != 0)
+    {
+        if (c != '%')
+        {
+            mcu_term_out_put_char(&ob, c);
+            continue;
+        }
+        c = mcu_term_read_byte_P(fmt_P++);
+        char fill = ' ';
+        if (c == '0')
+        {
+            fill = '0';
+            c = mcu_term_read_byte_P(fmt_P++);
+        }
+        size_t width = 0;
+        while ((c >= '0') && (c <= '9'))
+        {
+            width = (width * 10) + (c - '0');
+            c = mcu_term_read_byte_P(fmt_P++);
+        }
+        unsigned char is_long = 0;
+        if (c == 'l')
+        {
+            is_long = 1;
+            c = mcu_term_read_byte_P(fmt_P++);
+        }
+        char digits[11];
+        const char* str = digits;
+        size_t n = 0;
+        switch (c)
+        {
+        case 'c':
+            digits[0] = (char) va_arg(args, int);
+            n = 1;
+            break;
+        case 's':
+            str = va_arg(args, const char*);
+            n = strlen(str);
+            break;
+        case 'd':
+        {
+            const int32_t v = is_long ? (int32_t) va_arg(args, long int) :
+                    (int32_t) va_arg(args, int);
+            if (v < 0)
+            {
+                digits[n++] = '-';
+            }
+            n += mcu_term_render_udec(digits + n,
+                                      (v < 0) ? -(uint32_t) v : (uint32_t) v);
+            break;
+        }
+        case 'u':
+        case 'x':
+        {
+            const uint32_t v = is_long ?
+                    (uint32_t) va_arg(args, unsigned long int) :
+                    (uint32_t) va_arg(args, unsigned int);
+            n = (c == 'u') ? mcu_term_render_udec(digits, v) :
+                    mcu_term_render_hex(digits, v);
+            break;
+        }
+        case 0:
+            // a lone % at the end
+            --fmt_P;
+            break;
+        default:
+            // %% and anything not in the subset come out as they are
+            digits[0] = c;
+            n = 1;
+            break;
+        }
+        while (width > n)
+        {
+            mcu_term_out_put_char(&ob, fill);
+            --width;
+        }
+        mcu_term_out_put(&ob, str, n);
+    }
+    va_end(args);
+    if (ob.population != 0)
+    {
+        ob.r |= mcu_term_out_write(ob.arr, ob.population);
+    }
+    return (ob.r != 0) ? -1 : 0;
+}
+
+#endif
+
+static void mcu_term_print_prompt(const struct mcu_term * const mt)
+{
+    if (mt->prompt_P != 0)
+    {
+        mcu_term_print_string_P(mt, mt->prompt_P);
+    }
+    else
+    {
+        mcu_term_print_string(mt, mt->prompt);
+    }
+}
+
+static int mcu_term_add(struct mcu_term * const mt, const char* const cmd,
+                        void(* const cb) (void*, size_t, char**),
+                        const struct mcu_term_schema* const schema,
+                        void(* const typed_cb) (void*, size_t, char**,
+                                                const int32_t*),
+                        void* const cb_arg)
 {
     // allocate memory for the string
     char* const cmd_cpy = mcu_term_allocate((strlen(cmd) + 1) *
@@ -82,9 +479,28 @@ int mcu_term_add_command(struct mcu_term * const mt, const char* const cmd,
     tmp->cmd = cmd_cpy;
     tmp->cb = cb;
     tmp->cb_arg = cb_arg;
+    tmp->schema = schema;
+    tmp->typed_cb = typed_cb;
     return 0;
 }
 
+int mcu_term_add_command(struct mcu_term * const mt, const char* const cmd,
+                         void(* const cb) (void*, size_t, char**),
+                         void* const cb_arg)
+{
+    return mcu_term_add(mt, cmd, cb, 0, 0, cb_arg);
+}
+
+int mcu_term_add_typed_command(struct mcu_term * const mt,
+                               const char* const cmd,
+                               const struct mcu_term_schema* const schema,
+                               void(* const typed_cb) (void*, size_t, char**,
+                                                       const int32_t*),
+                               void* const cb_arg)
+{
+    return mcu_term_add(mt, cmd, 0, schema, typed_cb, cb_arg);
+}
+
 int mcu_term_remove_command(struct mcu_term * const mt, const char* const cmd)
 {
     // find the cmd
@@ -117,87 +533,759 @@ int mcu_term_remove_command(struct mcu_term * const mt, const char* const cmd)
     return 0;
 }
 
-int mcu_term_write_char(struct mcu_term * const mt, const char c)
+int mcu_term_set_commands(struct mcu_term * const mt,
+                          const struct mcu_term_const_cmd* const cmds,
+                          const size_t size)
 {
-    switch (c)
+    // check the table is sorted, lookups depend on it
+    size_t i = 1;
+    while (i < size)
     {
-    case '\r':
-    { // process
-        mt->line.arr[mt->line.population] = 0;
-        size_t i = 0;
-        char last_c = ' ';
-        // split buffer with NULLs
-        while (i < mt->line.population)
-        {
-            char c = mt->line.arr[i];
-            if ((last_c == ' ') && (c != ' '))
-            { // beginning of word
-                ++(mt->argc);
-                char ** argv_tmp = mcu_term_reallocate(mt->argv, mt->argc *
-                                                       sizeof (*mt->argv));
-                if (argv_tmp == 0)
-                {
-                    return -1;
-                }
-                mt->argv = argv_tmp;
-                mt->argv[mt->argc - 1] = mt->line.arr + i;
+        struct mcu_term_const_cmd prev;
+        struct mcu_term_const_cmd next;
+        mcu_term_read_P(&prev, cmds + i - 1, sizeof (prev));
+        mcu_term_read_P(&next, cmds + i, sizeof (next));
+        // compare the two flash strings a byte at a time
+        size_t j = 0;
+        unsigned char pc;
+        unsigned char nc;
+        do
+        {
+            mcu_term_read_P(&pc, prev.cmd + j, 1);
+            mcu_term_read_P(&nc, next.cmd + j, 1);
+            ++j;
+        }
+        while ((pc == nc) && (pc != 0));
+        if (pc >= nc)
+        {
+            return -1;
+        }
+        ++i;
+    }
+    mt->const_cmds = cmds;
+    mt->const_cmds_size = size;
+    return 0;
+}
+
+int mcu_term_spawn(int(* const task) (void*), void* const arg)
+{
+    struct mcu_term * const mt = mcu_term_dispatching;
+    if (mt == 0)
+    {
+        return -1;
+    }
+    mt->task = task;
+    mt->task_arg = arg;
+    return 0;
+}
+
+static void mcu_term_stream_end(struct mcu_term * const mt);
+
+int mcu_term_run(struct mcu_term * const mt)
+{
+    if (mt->task == 0)
+    {
+        return 0;
+    }
+    if (mt->task(mt->task_arg) != MCU_TASK_DONE)
+    {
+        return 1;
+    }
+    mt->task = 0;
+    if ((mt->line_flags & MCU_TERM_LINE_ENDING) != 0)
+    { // the last streamed argument is done with
+        mcu_term_stream_end(mt);
+        if (mt->task != 0)
+        {
+            return 1;
+        }
+    }
+    else if (mt->stream != 0)
+    { // more of the line to come
+        return 0;
+    }
+    if (mt->batch == 0)
+    { // the prompt the command held back
+        mcu_term_print_prompt(mt);
+    }
+    return 0;
+}
+
+unsigned char mcu_term_busy(const struct mcu_term * const mt)
+{
+    return (mt->task != 0) ? 1 : 0;
+}
+
+void mcu_term_set_echo(struct mcu_term * const mt,
+                       const enum mcu_term_echo echo)
+{
+    mt->echo = echo;
+}
+
+void mcu_term_set_batch(struct mcu_term * const mt, const unsigned char batch)
+{
+    mt->batch = batch;
+}
+
+#if !defined(MCU_TERM_NO_BUILTINS)
+
+static const char mcu_term_builtin_str[] MCU_TERM_PROGMEM = "term";
+static const char mcu_term_echo_str[] MCU_TERM_PROGMEM = "echo";
+static const char mcu_term_batch_str[] MCU_TERM_PROGMEM = "batch";
+static const char mcu_term_on_str[] MCU_TERM_PROGMEM = "on";
+static const char mcu_term_off_str[] MCU_TERM_PROGMEM = "off";
+static const char mcu_term_line_str[] MCU_TERM_PROGMEM = "line";
+static const char mcu_term_usage_str[] MCU_TERM_PROGMEM =
+        "usage: term echo on|off|line, term batch on|off\r\n";
+
+// "term echo on|off|line" and "term batch on|off", so a script can turn the
+// echo and the prompt off before it streams commands in
+static void mcu_term_builtin(struct mcu_term * const mt)
+{
+    if (mt->argc == 3)
+    {
+        const char* const value = mt->argv[2];
+        if (mcu_term_strcmp_P(mt->argv[1], mcu_term_echo_str) == 0)
+        {
+            if (mcu_term_strcmp_P(value, mcu_term_on_str) == 0)
+            {
+                mt->echo = MCU_TERM_ECHO_FULL;
+                return;
+            }
+            if (mcu_term_strcmp_P(value, mcu_term_off_str) == 0)
+            {
+                mt->echo = MCU_TERM_ECHO_OFF;
+                return;
+            }
+            if (mcu_term_strcmp_P(value, mcu_term_line_str) == 0)
+            {
+                mt->echo = MCU_TERM_ECHO_LINE;
+                return;
+            }
+        }
+        else if (mcu_term_strcmp_P(mt->argv[1], mcu_term_batch_str) == 0)
+        {
+            if (mcu_term_strcmp_P(value, mcu_term_on_str) == 0)
+            {
+                mt->batch = 1;
+                return;
+            }
+            if (mcu_term_strcmp_P(value, mcu_term_off_str) == 0)
+            {
+                mt->batch = 0;
+                return;
             }
+        }
+    }
+    mcu_term_print_string_P(mt, mcu_term_usage_str);
+}
 
-            if ((last_c != ' ') && (c == ' '))
-            { // end of a word
-                mt->line.arr[i] = 0;
+#endif
+
+// multiplies by a base of 8, 10 or 16 with shifts, the ATtiny has no
+// multiplier
+static inline uint32_t mcu_term_scale(const uint32_t v, const uint8_t base)
+{
+    if (base == 10)
+    {
+        return (v << 3) + (v << 1);
+    }
+    return v << ((base == 16) ? 4 : 3);
+}
+
+int mcu_term_parse_int(const char* str, uint8_t base, int32_t* const value)
+{
+    const unsigned char negative = (*str == '-') ? 1 : 0;
+    if ((*str == '-') || (*str == '+'))
+    {
+        ++str;
+    }
+    if (base == 0)
+    {
+        base = 10;
+        if (*str == '0')
+        {
+            base = 8;
+            if ((str[1] == 'x') || (str[1] == 'X'))
+            {
+                base = 16;
+                str += 2;
             }
-            last_c = c;
+        }
+    }
+    if (*str == 0)
+    {
+        return -1;
+    }
+    // anything above this overflows when scaled
+    const uint32_t limit = (base == 10) ? (UINT32_MAX / 10) :
+            (UINT32_MAX >> ((base == 16) ? 4 : 3));
+    uint32_t v = 0;
+    char c;
+    while ((c = *str++) != 0)
+    {
+        uint8_t d;
+        if ((c >= '0') && (c <= '9'))
+        {
+            d = c - '0';
+        }
+        else if ((c >= 'a') && (c <= 'f'))
+        {
+            d = c - 'a' + 10;
+        }
+        else if ((c >= 'A') && (c <= 'F'))
+        {
+            d = c - 'A' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+        if ((d >= base) || (v > limit))
+        {
+            return -1;
+        }
+        const uint32_t scaled = mcu_term_scale(v, base);
+        v = scaled + d;
+        if (v < scaled)
+        {
+            return -1;
+        }
+    }
+    if (negative != 0)
+    {
+        if (v > ((uint32_t) INT32_MAX + 1))
+        {
+            return -1;
+        }
+        *value = (int32_t) (0u - v);
+    }
+    else
+    {
+        if (v > INT32_MAX)
+        {
+            return -1;
+        }
+        *value = (int32_t) v;
+    }
+    return 0;
+}
+
+static const char mcu_term_args_str[] MCU_TERM_PROGMEM =
+        "Invalid number of args, %s requires %u\r\n";
+static const char mcu_term_min_args_str[] MCU_TERM_PROGMEM =
+        "Invalid number of args, %s requires at least %u\r\n";
+static const char mcu_term_max_args_str[] MCU_TERM_PROGMEM =
+        "Invalid number of args, %s takes at most %u\r\n";
+static const char mcu_term_range_str[] MCU_TERM_PROGMEM =
+        "%s is not an integer from %ld to %ld\r\n";
+
+// 0 if the schema takes args arguments, -1 with the reason printed otherwise
+static int mcu_term_check_count(const struct mcu_term_schema * const schema,
+                                const size_t args, const char* const name)
+{
+    if ((args >= schema->min_args) && (args <= schema->max_args))
+    {
+        return 0;
+    }
+    const char* const fmt_P = (schema->min_args == schema->max_args) ?
+            mcu_term_args_str : ((args < schema->min_args) ?
+                                 mcu_term_min_args_str :
+                                 mcu_term_max_args_str);
+    mcu_term_printf_P(fmt_P, name, (unsigned int)
+                      ((args < schema->min_args) ? schema->min_args :
+                       schema->max_args));
+    return -1;
+}
+
+// checks the arguments against the schema in flash and converts them, 0 if
+// they are fine and -1, with the reason printed, otherwise
+static int mcu_term_convert(const struct mcu_term_schema* const schema_P,
+                            const size_t argc, char** const argv,
+                            int32_t* const values)
+{
+    struct mcu_term_schema schema;
+    mcu_term_read_P(&schema, schema_P, sizeof (schema));
+    const size_t args = argc - 1;
+    if (mcu_term_check_count(&schema, args, argv[0]) != 0)
+    {
+        return -1;
+    }
+    if (args > MCU_TERM_TYPED_ARGS)
+    {
+        return -1;
+    }
+    size_t i = 0;
+    while (i < args)
+    {
+        int32_t* const v = values + i;
+        if ((mcu_term_parse_int(argv[i + 1], schema.base, v) != 0) ||
+            (*v < schema.min) || (*v > schema.max))
+        {
+            mcu_term_printf_P(mcu_term_range_str, argv[i + 1],
+                              (long int) schema.min, (long int) schema.max);
+            return -1;
+        }
+        ++i;
+    }
+    return 0;
+}
+
+static int mcu_term_invoke(void(* const cb) (void*, size_t, char**),
+                           const struct mcu_term_schema* const schema_P,
+                           void(* const typed_cb) (void*, size_t, char**,
+                                                   const int32_t*),
+                           void* const cb_arg, const size_t argc,
+                           char** const argv)
+{
+    if (schema_P == 0)
+    {
+        cb(cb_arg, argc, argv);
+        return 0;
+    }
+    int32_t values[MCU_TERM_TYPED_ARGS];
+    if (mcu_term_convert(schema_P, argc, argv, values) != 0)
+    {
+        return -1;
+    }
+    typed_cb(cb_arg, argc, argv, values);
+    return 0;
+}
+
+// a streaming command given a whole line, the arguments are passed one
+// after the other so none of them may be left to a task
+static int mcu_term_stream_call(const struct mcu_term_const_cmd * const cmd,
+                                const size_t argc, char** const argv)
+{
+    struct mcu_term_stream stream;
+    mcu_term_read_P(&stream, cmd->stream, sizeof (stream));
+    void* const state = stream.begin(cmd->cb_arg);
+    if (state != 0)
+    {
+        struct mcu_term * const dispatching = mcu_term_dispatching;
+        mcu_term_dispatching = 0;
+        size_t i = 1;
+        while (i < argc)
+        {
+            stream.token(state, argv[i]);
             ++i;
         }
-		
-		mt->print('\r');
-		mt->print('\n');
-        if (mt->argc > 0)
+        mcu_term_dispatching = dispatching;
+    }
+    stream.end(state, argc - 1, 1);
+    return (state != 0) ? 0 : -1;
+}
+
+int mcu_term_call(const struct mcu_term_const_cmd * const cmd,
+                  const size_t argc, char** const argv)
+{
+    if (cmd->stream != 0)
+    {
+        return mcu_term_stream_call(cmd, argc, argv);
+    }
+    return mcu_term_invoke(cmd->cb, cmd->schema, cmd->typed_cb, cmd->cb_arg,
+                           argc, argv);
+}
+
+int mcu_term_call_values(const struct mcu_term_const_cmd * const cmd,
+                         const size_t argc, char** const argv,
+                         const int32_t* const values)
+{
+    struct mcu_term_schema schema;
+    mcu_term_read_P(&schema, cmd->schema, sizeof (schema));
+    const size_t args = argc - 1;
+    if ((mcu_term_check_count(&schema, args, argv[0]) != 0) ||
+        (args > MCU_TERM_TYPED_ARGS))
+    {
+        return -1;
+    }
+    size_t i = 0;
+    while (i < args)
+    {
+        if ((values[i] < schema.min) || (values[i] > schema.max))
+        {
+            char text[12];
+            mcu_term_format_dec(text, values[i]);
+            mcu_term_printf_P(mcu_term_range_str, text,
+                              (long int) schema.min, (long int) schema.max);
+            return -1;
+        }
+        ++i;
+    }
+    cmd->typed_cb(cmd->cb_arg, argc, argv, values);
+    return 0;
+}
+
+// binary search of the const table for name, 0 if found and copied to cmd
+static int mcu_term_find_const(const struct mcu_term * const mt,
+                               const char* const name,
+                               struct mcu_term_const_cmd * const cmd)
+{
+    size_t lo = 0;
+    size_t hi = mt->const_cmds_size;
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) >> 1);
+        mcu_term_read_P(cmd, mt->const_cmds + mid, sizeof (*cmd));
+        const int cmp = mcu_term_strcmp_P(name, cmd->cmd);
+        if (cmp == 0)
+        {
+            return 0;
+        }
+        if (cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+// looks up argv[0], the const table first then the dynamic commands, and
+// calls the command if it exists. The built in command is looked for last so
+// it costs nothing when one of the tables matches.
+static void mcu_term_dispatch(struct mcu_term * const mt)
+{
+    struct mcu_term_const_cmd cmd;
+    if (mcu_term_find_const(mt, mt->argv[0], &cmd) == 0)
+    {
+        mcu_term_call(&cmd, mt->argc, mt->argv);
+        return;
+    }
+    // linear search of the dynamic commands
+    struct mcu_term_cmd* cmds_itt = mt->cmds;
+    struct mcu_term_cmd * const cmds_limit = mt->cmds + mt->cmds_size;
+    while ((cmds_itt != cmds_limit) && (strcmp(cmds_itt->cmd,
+                                               mt->argv[0]) != 0))
+    {
+        ++cmds_itt;
+    }
+    if (cmds_itt != cmds_limit)
+    { // call command if it exists
+        mcu_term_invoke(cmds_itt->cb, cmds_itt->schema, cmds_itt->typed_cb,
+                        cmds_itt->cb_arg, mt->argc, mt->argv);
+    }
+#if !defined(MCU_TERM_NO_BUILTINS)
+    else if (mcu_term_strcmp_P(mt->argv[0], mcu_term_builtin_str) == 0)
+    {
+        mcu_term_builtin(mt);
+    }
+#endif
+}
+
+// echoes the completed line in one write. Spaces are stored as NULLs, they
+// are put back for the write and taken out again afterwards.
+static void mcu_term_echo_line(struct mcu_term * const mt)
+{
+    char* const arr = mt->line.arr;
+    const size_t population = mt->line.population;
+    size_t i = 0;
+    while (i < population)
+    {
+        if (arr[i] == 0)
+        {
+            arr[i] = ' ';
+        }
+        ++i;
+    }
+    mcu_term_emit(mt, arr, population);
+    i = 0;
+    while (i < population)
+    {
+        if (arr[i] == ' ')
         {
-            // search for command
-            struct mcu_term_cmd* cmds_itt = mt->cmds;
-            struct mcu_term_cmd * const cmds_limit = mt->cmds + mt->cmds_size;
-            while ((cmds_itt != cmds_limit) && (strcmp(cmds_itt->cmd,
-                                                       mt->argv[0]) != 0))
+            arr[i] = 0;
+        }
+        ++i;
+    }
+}
+
+static const char mcu_term_long_str[] MCU_TERM_PROGMEM =
+        "line too long, ignored\r\n";
+
+// the word in the buffer and the space after it, for MCU_TERM_ECHO_LINE
+// once the word has been taken out of the buffer
+static void mcu_term_echo_word(struct mcu_term * const mt)
+{
+    if (mt->echo == MCU_TERM_ECHO_LINE)
+    {
+        mcu_term_echo_line(mt);
+        mcu_term_emit(mt, " ", 1);
+    }
+}
+
+// the command name has been followed by a space. If it is a streaming
+// command the line goes to it from here on and the buffer is emptied.
+static void mcu_term_name_end(struct mcu_term * const mt)
+{
+    mt->line_flags |= MCU_TERM_LINE_NAMED;
+    mt->line.arr[mt->line.population] = 0;
+    struct mcu_term_const_cmd cmd;
+    if ((mcu_term_find_const(mt, mt->argv[0], &cmd) != 0) ||
+        (cmd.stream == 0))
+    {
+        return;
+    }
+    struct mcu_term_stream stream;
+    mcu_term_read_P(&stream, cmd.stream, sizeof (stream));
+    mcu_term_echo_word(mt);
+    mt->stream = cmd.stream;
+    mt->stream_state = stream.begin(cmd.cb_arg);
+    mt->stream_count = 0;
+    mt->line.population = 0;
+    mt->argc = 0;
+}
+
+// passes the word in the buffer to the streaming command, unless it refused
+// the line or part of it was lost, and empties the buffer for the next one.
+// The buffer is not written to while a task the token spawned is running.
+static void mcu_term_stream_token(struct mcu_term * const mt)
+{
+    mt->line.arr[mt->line.population] = 0;
+    if ((mt->stream_state != 0) &&
+        ((mt->line_flags & MCU_TERM_LINE_LONG) == 0))
+    {
+        struct mcu_term_stream stream;
+        mcu_term_read_P(&stream, mt->stream, sizeof (stream));
+        mcu_term_dispatching = mt;
+        stream.token(mt->stream_state, mt->line.arr);
+        mcu_term_dispatching = 0;
+    }
+    ++mt->stream_count;
+    mt->line.population = 0;
+    mt->argc = 0;
+}
+
+static void mcu_term_stream_end(struct mcu_term * const mt)
+{
+    const unsigned char complete =
+            ((mt->line_flags & MCU_TERM_LINE_LONG) == 0) ? 1 : 0;
+    if (complete == 0)
+    {
+        mcu_term_print_string_P(mt, mcu_term_long_str);
+    }
+    struct mcu_term_stream stream;
+    mcu_term_read_P(&stream, mt->stream, sizeof (stream));
+    mt->stream = 0;
+    mt->line_flags = 0;
+    mcu_term_dispatching = mt;
+    stream.end(mt->stream_state, mt->stream_count, complete);
+    mcu_term_dispatching = 0;
+}
+
+int mcu_term_write_char(struct mcu_term * const mt, const char c)
+{
+    if (mt->task != 0)
+    {
+        return -1;
+    }
+    switch (c)
+    {
+    case '\r':
+    { // process, the words were split and counted as they arrived
+        mt->line.arr[mt->line.population] = 0;
+        if (mt->echo == MCU_TERM_ECHO_LINE)
+        {
+            mcu_term_echo_line(mt);
+        }
+        if (mt->echo != MCU_TERM_ECHO_OFF)
+        {
+            mcu_term_emit(mt, "\r\n", 2);
+        }
+        if (mt->stream != 0)
+        { // the last argument, then the end once the argument is done with
+            if (mt->line.population != 0)
             {
-                ++cmds_itt;
+                mcu_term_stream_token(mt);
             }
-            if (cmds_itt != cmds_limit)
-            { // call command if it exists
-                cmds_itt->cb(cmds_itt->cb_arg, mt->argc, mt->argv);
+            if (mt->task != 0)
+            {
+                mt->line_flags |= MCU_TERM_LINE_ENDING;
+                break;
             }
-            mcu_term_deallocate(mt->argv);
-            mt->argc = 0;
-            mt->argv = 0;
+            mcu_term_stream_end(mt);
+        }
+        else if ((mt->line_flags & MCU_TERM_LINE_LONG) != 0)
+        { // a truncated line could still be a valid command
+            mcu_term_print_string_P(mt, mcu_term_long_str);
         }
+        else if (mt->argc > 0)
+        {
+            mcu_term_dispatching = mt;
+            mcu_term_dispatch(mt);
+            mcu_term_dispatching = 0;
+        }
+        mt->argc = 0;
         mt->line.population = 0;
-        mcu_term_print_string(mt, mt->prompt);
+        mt->line_flags = 0;
+        if ((mt->batch == 0) && (mt->task == 0))
+        {
+            mcu_term_print_prompt(mt);
+        }
         break;
     }
     case '\b':
         if (mt->line.population != 0)
         {
-            mt->print('\b');
-            mt->print(' ');
-            mt->print('\b');
-            --mt->line.population;
+            if (mt->echo == MCU_TERM_ECHO_FULL)
+            {
+                mcu_term_emit(mt, "\b \b", 3);
+            }
+            const size_t i = --mt->line.population;
+            if ((mt->line.arr[i] != 0) && ((i == 0) ||
+                                           (mt->line.arr[i - 1] == 0)))
+            { // erased the first character of the last word
+                --mt->argc;
+            }
+            if ((mt->stream == 0) && (mt->argc <= 1) &&
+                ((i == 0) || (mt->line.arr[i - 1] != 0)))
+            { // back into the name, the space after it is looked for again
+                mt->line_flags &= ~MCU_TERM_LINE_NAMED;
+            }
         }
         break;
     case '\n':// ignore newline
         break;
     default:
-		if (mt->line.population < MCU_TERM_BUFFER_SIZE)
-		{
-			mt->line.arr[mt->line.population] = c;
+        if (c == ' ')
+        {
+            if (mt->stream != 0)
+            { // the word is passed on, spaces between words are not kept
+                if (mt->line.population != 0)
+                {
+                    mcu_term_echo_word(mt);
+                    mcu_term_stream_token(mt);
+                }
+                if (mt->echo == MCU_TERM_ECHO_FULL)
+                {
+                    mcu_term_emit(mt, &c, 1);
+                }
+                break;
+            }
+            if (((mt->line_flags & MCU_TERM_LINE_NAMED) == 0) &&
+                (mt->argc == 1) &&
+                (mt->line.arr[mt->line.population - 1] != 0))
+            {
+                mcu_term_name_end(mt);
+                if (mt->stream != 0)
+                {
+                    if (mt->echo == MCU_TERM_ECHO_FULL)
+                    {
+                        mcu_term_emit(mt, &c, 1);
+                    }
+                    break;
+                }
+            }
+        }
+		if (mt->line.population < MCU_TERM_BUFFER_SIZE - 1)
+		{ // leave room for the terminating NULL
+            const size_t i = mt->line.population;
+            if (c == ' ')
+            { // spaces are stored as NULLs so each word is terminated
+                mt->line.arr[i] = 0;
+            }
+            else
+            {
+                if ((i == 0) || (mt->line.arr[i - 1] == 0))
+                { // beginning of word
+                    mt->argv[mt->argc] = mt->line.arr + i;
+                    ++(mt->argc);
+                }
+                mt->line.arr[i] = c;
+            }
 			++mt->line.population;
-			mt->print(c);
+			if (mt->echo == MCU_TERM_ECHO_FULL)
+			{
+				mcu_term_emit(mt, &c, 1);
+			}
 		}
+        else
+        {
+            mt->line_flags |= MCU_TERM_LINE_LONG;
+        }
         break;
     }
     return 0;
 }
 
+// appends a run of ordinary characters in one go, splitting and counting the
+// words in it, anything past the end of the line buffer is discarded and the
+// line refused
+static void mcu_term_append(struct mcu_term * const mt, const char* const run,
+                            size_t size)
+{
+    const size_t space = MCU_TERM_BUFFER_SIZE - 1 - mt->line.population;
+    if (size > space)
+    {
+        size = space;
+        mt->line_flags |= MCU_TERM_LINE_LONG;
+    }
+    char* const start = mt->line.arr + mt->line.population;
+    memcpy(start, run, size);
+    char last_c = (mt->line.population == 0) ? 0 : start[-1];
+    size_t i = 0;
+    while (i < size)
+    {
+        if (start[i] == ' ')
+        {
+            start[i] = 0;
+        }
+        else if (last_c == 0)
+        { // beginning of word
+            mt->argv[mt->argc] = start + i;
+            ++(mt->argc);
+        }
+        last_c = start[i];
+        ++i;
+    }
+    mt->line.population += size;
+    if (mt->echo == MCU_TERM_ECHO_FULL)
+    {
+        mcu_term_emit(mt, run, size);
+    }
+}
+
+int mcu_term_write_buf(struct mcu_term * const mt, const char* buf,
+                       const size_t size)
+{
+    if (mt->task != 0)
+    {
+        return -1;
+    }
+    const char* const start = buf;
+    const char* const limit = buf + size;
+    while ((buf != limit) && (mt->task == 0))
+    {
+        // a space may end the command name or a streamed argument, it is
+        // handled on its own until the name is known not to stream
+        const char space = ((mt->stream != 0) ||
+                            ((mt->line_flags & MCU_TERM_LINE_NAMED) == 0)) ?
+                ' ' : '\r';
+        const char* run_limit = buf;
+        while ((run_limit != limit) && (*run_limit != '\r') &&
+               (*run_limit != '\b') && (*run_limit != '\n') &&
+               (*run_limit != space))
+        {
+            ++run_limit;
+        }
+        if (run_limit != buf)
+        {
+            mcu_term_append(mt, buf, run_limit - buf);
+            buf = run_limit;
+        }
+        else
+        { // only '\r', '\b', '\n' and some spaces are handled a character
+          // at a time
+            mcu_term_write_char(mt, *buf);
+            ++buf;
+        }
+    }
+    return buf - start;
+}
+
 void mcu_term_destroy(struct mcu_term * const mt)
 {
     // deallocate command strings
@@ -211,14 +1299,34 @@ void mcu_term_destroy(struct mcu_term * const mt)
     // deallocate command struct array
     mcu_term_deallocate(mt->cmds);
     mcu_term_deallocate(mt->prompt);
-    if (mt->argv != 0)
-    {
-        mcu_term_deallocate(mt->argv);
-    }
+}
+
+static void mcu_term_init_common(struct mcu_term * const mt,
+                                 char (* const print) (char),
+                                 int (* const write) (const char*, size_t))
+{
+    mt->line.population = 0;
+    mt->argc = 0;
+    mt->cmds = 0;
+    mt->cmds_size = 0;
+    mt->const_cmds = 0;
+    mt->const_cmds_size = 0;
+    mt->print = print;
+    mt->write = write;
+    mt->echo = MCU_TERM_ECHO_FULL;
+    mt->batch = 0;
+    mt->task = 0;
+    mt->task_arg = 0;
+    mt->stream = 0;
+    mt->stream_state = 0;
+    mt->stream_count = 0;
+    mt->line_flags = 0;
+    mcu_term_print_prompt(mt);
 }
 
 int mcu_term_init(struct mcu_term * const mt, const char* const prompt,
-                  char (* const print) (char))
+                  char (* const print) (char),
+                  int (* const write) (const char*, size_t))
 {
     mt->prompt = mcu_term_allocate((strlen(prompt) + 1) * sizeof (*mt->prompt));
     if (mt->prompt == 0)
@@ -226,12 +1334,18 @@ int mcu_term_init(struct mcu_term * const mt, const char* const prompt,
         return -1;
     }
     strcpy(mt->prompt, prompt);
-    mt->line.population = 0;
-    mt->argc = 0;
-    mt->argv = 0;
-    mt->cmds = 0;
-    mt->cmds_size = 0;
-    mt->print = print;
-    mcu_term_print_string(mt, mt->prompt);
+    mt->prompt_P = 0;
+    mcu_term_init_common(mt, print, write);
+    return 0;
+}
+
+// the prompt is used in place from flash, nothing is allocated
+int mcu_term_init_P(struct mcu_term * const mt, const char* const prompt_P,
+                    char (* const print) (char),
+                    int (* const write) (const char*, size_t))
+{
+    mt->prompt = 0;
+    mt->prompt_P = prompt_P;
+    mcu_term_init_common(mt, print, write);
     return 0;
 }
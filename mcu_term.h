@@ -24,15 +24,98 @@ THE SOFTWARE.
 #ifndef MCU_TERM_H
 #define	MCU_TERM_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define MCU_TERM_PROGMEM PROGMEM
+#else
+#define MCU_TERM_PROGMEM
+#endif
+
 #define MCU_TERM_BUFFER_SIZE 81
+// a line of MCU_TERM_BUFFER_SIZE - 1 characters holds at most this many words
+#define MCU_TERM_MAX_ARGS (MCU_TERM_BUFFER_SIZE / 2)
+// stack buffer of mcu_term_printf_P, longer output is written in pieces
+#define MCU_TERM_OUT_SIZE 24
+
+// the integer arguments a command takes, checked and converted once by the
+// terminal so the command gets their values. There must be min_args to
+// max_args of them after the command name, each in base from min to max. A
+// base of 0 takes 0x and 0 prefixes as strtol does, otherwise it is 8, 10 or
+// 16. max_args may be at most MCU_TERM_TYPED_ARGS.
+#define MCU_TERM_TYPED_ARGS 4
+
+struct mcu_term_schema
+{
+    uint8_t min_args;
+    uint8_t max_args;
+    uint8_t base;
+    int32_t min;
+    int32_t max;
+};
+
+// a command that takes its arguments as they are typed instead of from the
+// line buffer, so its line may be any length as long as each argument fits
+// in the buffer. Once the command name is followed by a space begin is called
+// with the command's cb_arg and returns the state passed to the others, or 0
+// to refuse the line. token gets each argument, NUL terminated, when the
+// space or enter after it arrives, end gets the number of arguments when
+// enter is pressed and says why if the line was refused. complete is 0 if an
+// argument did not fit in the buffer, the terminal has said so and the
+// command only has to let go of its state. token and end may spawn a task
+// (mcu_term_spawn), no input is taken until it has finished and the token
+// stays valid for it. Lives in flash on AVR, as const command tables do.
+struct mcu_term_stream
+{
+    void* (*begin)(void*);
+    void(*token)(void*, const char*);
+    void(*end)(void*, size_t, unsigned char);
+};
 
 struct mcu_term_cmd
 {
     void(*cb)(void*, size_t, char**);
     void* cb_arg;
     char* cmd;
+    // set instead of cb by mcu_term_add_typed_command
+    const struct mcu_term_schema* schema;
+    void(*typed_cb)(void*, size_t, char**, const int32_t*);
+};
+
+// entry of a command table fixed at build time, the table and the strings its
+// entries point to are placed in flash on AVR with MCU_TERM_PROGMEM, e.g.
+//
+// static const char gcd_str[] MCU_TERM_PROGMEM = "gcd";
+// static const struct mcu_term_schema gcd_schema MCU_TERM_PROGMEM = {
+//     2, 2, 0, INT32_MIN, INT32_MAX
+// };
+// static const struct mcu_term_const_cmd cmds[] MCU_TERM_PROGMEM = {
+//     { gcd_str, 0, 0, &gcd_schema, &gcd_cmd_cb, 0 }, ...
+// };
+//
+// the table must be sorted by cmd in strcmp order, lookups binary search it.
+// A command with a schema (in flash too) is called through typed_cb with the
+// values of its arguments, a command with a stream through that, otherwise
+// it is called through cb.
+struct mcu_term_const_cmd
+{
+    const char* cmd;
+    void(*cb)(void*, size_t, char**);
+    void* cb_arg;
+    const struct mcu_term_schema* schema;
+    void(*typed_cb)(void*, size_t, char**, const int32_t*);
+    const struct mcu_term_stream* stream;
+};
+
+// what is echoed back as characters are typed. MCU_TERM_ECHO_LINE echoes
+// nothing until enter is pressed and then the whole line at once.
+enum mcu_term_echo
+{
+    MCU_TERM_ECHO_FULL,
+    MCU_TERM_ECHO_OFF,
+    MCU_TERM_ECHO_LINE
 };
 
 struct mcu_term_line
@@ -45,21 +128,105 @@ struct mcu_term
 {
     struct mcu_term_line line;
     char(*print)(char);
+    // optional, when set all output goes through it in as few calls as
+    // possible and print is not used. Returns 0 if everything was written.
+    int(*write)(const char*, size_t);
     char* prompt;
+    const char* prompt_P; // in flash, used instead of prompt when set
     struct mcu_term_cmd* cmds;
     size_t cmds_size;
-    char** argv;
+    const struct mcu_term_const_cmd* const_cmds;
+    size_t const_cmds_size;
+    char* argv[MCU_TERM_MAX_ARGS];
     size_t argc;
+    enum mcu_term_echo echo;
+    unsigned char batch; // no prompt between commands when set
+    // the rest of a command that is still running, see mcu_term_spawn
+    int(*task)(void*);
+    void* task_arg;
+    // the command the line is streamed to and its state, see
+    // struct mcu_term_stream. stream is in flash and 0 for ordinary lines,
+    // stream_state is 0 if the command refused the line.
+    const struct mcu_term_stream* stream;
+    void* stream_state;
+    size_t stream_count;
+    unsigned char line_flags; // MCU_TERM_LINE_* in mcu_term.c
 };
 
 int mcu_term_add_command(struct mcu_term * const mt, const char* const cmd,
                          void(* const cb) (void*, size_t, char**),
                          void* const cb_arg);
+// schema is in flash on AVR, as for const commands
+int mcu_term_add_typed_command(struct mcu_term * const mt,
+                               const char* const cmd,
+                               const struct mcu_term_schema* const schema,
+                               void(* const typed_cb) (void*, size_t, char**,
+                                                       const int32_t*),
+                               void* const cb_arg);
 int mcu_term_remove_command(struct mcu_term * const mt, const char* const cmd);
+int mcu_term_set_commands(struct mcu_term * const mt,
+                          const struct mcu_term_const_cmd* const cmds,
+                          const size_t size);
+// calls cmd, a copy in RAM of a const table entry, through its schema if it
+// has one, for front ends other than the terminal such as mcu_bin. Returns -1
+// if the arguments were refused, the reason has been printed.
+int mcu_term_call(const struct mcu_term_const_cmd * const cmd,
+                  const size_t argc, char** const argv);
+// calls cmd, which must have a schema, with arguments that are already
+// values, checking them against the schema as mcu_term_call would their text.
+// argv need only hold the name, typed_cb is always given the values.
+int mcu_term_call_values(const struct mcu_term_const_cmd * const cmd,
+                         const size_t argc, char** const argv,
+                         const int32_t* const values);
+// writes v as decimal text and a terminator to buf, which must hold 12 bytes,
+// by subtracting powers of ten on AVR. Returns the bytes used.
+size_t mcu_term_format_dec(char* const buf, const int32_t v);
+// the value of an integer argument in base 8, 10 or 16, or 0 for strtol's
+// prefixes. Returns -1 if str is not one or does not fit into an int32_t.
+int mcu_term_parse_int(const char* str, uint8_t base, int32_t* const value);
+void mcu_term_set_echo(struct mcu_term * const mt,
+                       const enum mcu_term_echo echo);
+void mcu_term_set_batch(struct mcu_term * const mt, const unsigned char batch);
+// called from a command callback, or a stream's token or end, to finish the
+// command a slice at a time, task is called by mcu_term_run until it returns
+// MCU_TASK_DONE (see mcu_task.h) and the prompt waits until then. No input
+// is taken meanwhile, so the argv the callback was given stays valid for the
+// task. Returns -1 if the callback was not called by a terminal, the command
+// must then finish by itself.
+int mcu_term_spawn(int(* const task) (void*), void* const arg);
+// runs a slice of the running command, returns 1 while there is more to do
+int mcu_term_run(struct mcu_term * const mt);
+unsigned char mcu_term_busy(const struct mcu_term * const mt);
+// input must not be written while the terminal is busy, mcu_term_write_char
+// returns -1 then and mcu_term_write_buf stops after the line that started a
+// task, returning the number of characters it took
 int mcu_term_write_char(struct mcu_term * const mt, const char c);
+int mcu_term_write_buf(struct mcu_term * const mt, const char* buf,
+                       const size_t size);
+int mcu_term_print_string(const struct mcu_term * const mt, const char* str);
+int mcu_term_print_string_P(const struct mcu_term * const mt,
+                            const char* str_P);
+// output for commands without printf, each call renders into a stack buffer
+// and goes to the write set by mcu_term_set_output in one block. Numbers are
+// 32 bit. mcu_term_printf_P takes %c, %s, %d, %u, %x and %%, with an
+// optional l, and a width that may start with 0 for zero padding. All return
+// 0 if everything was written. With MCU_TERM_OUT_PRINTF defined
+// mcu_term_printf_P is vprintf to stdout instead, to compare against.
+void mcu_term_set_output(int(* const write) (const char*, size_t));
+int mcu_term_out(const char* str);
+int mcu_term_out_P(const char* str_P);
+int mcu_term_out_char(const char c);
+int mcu_term_out_dec(const int32_t v);
+int mcu_term_out_udec(const uint32_t v);
+int mcu_term_out_hex(const uint32_t v);
+int mcu_term_printf_P(const char* fmt_P, ...);
 void mcu_term_destroy(struct mcu_term * const mt);
 int mcu_term_init(struct mcu_term * const mt, const char* const prompt,
-                  char(* const print) (char));
+                  char(* const print) (char),
+                  int(* const write) (const char*, size_t));
+int mcu_term_init_P(struct mcu_term * const mt, const char* const prompt_P,
+                    char(* const print) (char),
+                    int(* const write) (const char*, size_t));
 
 #endif
 